@@ -22,6 +22,7 @@
 #include <litmus/rt_domain.h>
 #include <litmus/litmus_proc.h>
 #include <litmus/sched_trace.h>
+#include <litmus/membw.h>
 
 #ifdef CONFIG_SCHED_CPU_AFFINITY
 #include <litmus/affinity.h>
@@ -75,6 +76,98 @@ u64 cpu_stagger_offset(int cpu)
 	return offset;
 }
 
+/*
+ * struct rt_task grew a versioned extension after mem_budget_task. Binaries
+ * built against the old layout pass a shorter struct, so only the legacy part
+ * is accessed unless mem_budget_task, which lies inside it, is tagged with
+ * RT_TASK_MEM_ABI.
+ */
+#define RT_TASK_LEGACY_SIZE	offsetof(struct rt_task, mem_rd_bytes)
+
+static inline int rt_task_mem_abi(int mem_budget_task)
+{
+	return mem_budget_task & RT_TASK_MEM_ABI_MASK;
+}
+
+static int copy_rt_task_from_user(struct rt_task *tp,
+				  struct rt_task __user *param)
+{
+	memset(tp, 0, sizeof(*tp));
+	if (copy_from_user(tp, param, RT_TASK_LEGACY_SIZE))
+		return -EFAULT;
+	if (rt_task_mem_abi(tp->mem_budget_task) == RT_TASK_MEM_ABI &&
+	    copy_from_user((char *) tp + RT_TASK_LEGACY_SIZE,
+			   (char __user *) param + RT_TASK_LEGACY_SIZE,
+			   sizeof(*tp) - RT_TASK_LEGACY_SIZE))
+		return -EFAULT;
+	return 0;
+}
+
+/* The caller asks for the extension by tagging mem_budget_task in its
+ * buffer; it is tagged again on return if the extension was written. */
+static int copy_rt_task_to_user(struct rt_task __user *param,
+				struct rt_task *tp)
+{
+	int mb;
+
+	if (get_user(mb, &param->mem_budget_task))
+		return -EFAULT;
+	if (rt_task_mem_abi(mb) != RT_TASK_MEM_ABI)
+		return copy_to_user(param, tp, RT_TASK_LEGACY_SIZE) ?
+			-EFAULT : 0;
+	tp->mem_budget_task |= RT_TASK_MEM_ABI;
+	return copy_to_user(param, tp, sizeof(*tp)) ? -EFAULT : 0;
+}
+
+/*
+ * Fill in the memory budget of a legacy task (MB/s, 0 meaning
+ * DEFAULT_MEM_BUDGET_MB) in bytes, or derive mem_budget_task from the byte
+ * budgets of an extended one, and check both against what MemGuard may hand
+ * out at all.
+ */
+static int check_rt_task_mem_params(struct rt_task *tp, pid_t pid)
+{
+	u64 max_bps = (u64) memguard_max_bw() << 20;
+	u64 rd_bps, wr_bps;
+
+	if (rt_task_mem_abi(tp->mem_budget_task) != RT_TASK_MEM_ABI) {
+		if (tp->mem_budget_task == 0)
+			tp->mem_budget_task = DEFAULT_MEM_BUDGET_MB;
+		/* negative or tagged with an unknown version */
+		if (tp->mem_budget_task < 0 ||
+		    rt_task_mem_abi(tp->mem_budget_task))
+			goto bad;
+		tp->mem_period_us = USEC_PER_SEC;
+		tp->mem_rd_bytes = (u64) tp->mem_budget_task << 20;
+		tp->mem_burst_bytes = 0;
+	} else if (!tp->mem_period_us || !tp->mem_rd_bytes)
+		goto bad;
+	if (!tp->mem_wr_bytes)
+		tp->mem_wr_bytes = tp->mem_rd_bytes;
+	if (tp->mem_rd_bytes > MEMBW_MAX_BYTES ||
+	    tp->mem_wr_bytes > MEMBW_MAX_BYTES ||
+	    tp->mem_burst_bytes > MEMBW_MAX_BYTES)
+		goto bad;
+
+	rd_bps = membw_bps(tp->mem_rd_bytes, tp->mem_period_us);
+	wr_bps = membw_bps(tp->mem_wr_bytes, tp->mem_period_us);
+	if (rd_bps > max_bps || wr_bps > max_bps ||
+	    membw_bps(tp->mem_burst_bytes, tp->mem_period_us) > max_bps) {
+		printk(KERN_INFO "litmus: real-time task %d rejected "
+		       "because its memory bandwidth (%llu/%llu B/s) "
+		       "exceeds %d MB/s\n", pid, rd_bps, wr_bps,
+		       memguard_max_bw());
+		return -EINVAL;
+	}
+	tp->mem_budget_task = membw_bps_to_mb(rd_bps);
+	return 0;
+
+bad:
+	printk(KERN_INFO "litmus: real-time task %d rejected "
+	       "because its memory budget is invalid\n", pid);
+	return -EINVAL;
+}
+
 /*
  * sys_set_task_rt_param
  * @pid: Pid of the task which scheduling parameters must be changed
@@ -85,6 +178,8 @@ u64 cpu_stagger_offset(int cpu)
  *         ESRCH   if pid is not corrsponding
  *	           to a valid task.
  *	   EINVAL  if either period or execution cost is <=0
+ *	           or the memory budget is invalid or exceeds the MemGuard
+ *	           maximum
  *	   EPERM   if pid is a real-time task
  *	   0       if success
  *
@@ -106,10 +201,10 @@ asmlinkage long sys_set_rt_task_param(pid_t pid, struct rt_task __user * param)
 	if (pid < 0 || param == 0) {
 		goto out;
 	}
-	if (copy_from_user(&tp, param, sizeof(tp))) {
-		retval = -EFAULT;
+	retval = copy_rt_task_from_user(&tp, param);
+	if (retval)
 		goto out;
-	}
+	retval = -EINVAL;
 
 	/* Task search and manipulation must be protected */
 	read_lock_irq(&tasklist_lock);
@@ -124,8 +219,6 @@ asmlinkage long sys_set_rt_task_param(pid_t pid, struct rt_task __user * param)
 	/* set relative deadline to be implicit if left unspecified */
 	if (tp.relative_deadline == 0)
 		tp.relative_deadline = tp.period;
-	if (tp.mem_budget_task == 0)
-		tp.mem_budget_task = 100;
 	if (tp.exec_cost <= 0)
 		goto out_unlock;
 	if (tp.period <= 0)
@@ -154,6 +247,9 @@ asmlinkage long sys_set_rt_task_param(pid_t pid, struct rt_task __user * param)
 		       pid, tp.budget_policy);
 		goto out_unlock;
 	}
+	retval = check_rt_task_mem_params(&tp, pid);
+	if (retval)
+		goto out_unlock;
 
 	if (is_realtime(target)) {
 		/* The task is already a real-time task.
@@ -201,8 +297,7 @@ asmlinkage long sys_get_rt_task_param(pid_t pid, struct rt_task __user * param)
 	lp = source->rt_param.task_params;
 	read_unlock_irq(&tasklist_lock);
 	/* Do copying outside the lock */
-	retval =
-	    copy_to_user(param, &lp, sizeof(lp)) ? -EFAULT : 0;
+	retval = copy_rt_task_to_user(param, &lp);
       out:
 	return retval;
 
@@ -0,0 +1,183 @@
+/*
+ * litmus/membw.h
+ *
+ * Interface between the LITMUS^RT scheduler plugins and the MemGuard
+ * memory bandwidth regulator (drivers/memguard). Admission control and the
+ * bandwidth pools count in MB/s; the limits MemGuard programs are exact in
+ * bytes/s.
+ */
+#ifndef _LITMUS_MEMBW_H_
+#define _LITMUS_MEMBW_H_
+
+#include <linux/cpumask.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/time.h>
+
+#include <litmus/ctrlpage.h>
+#include <litmus/sched_trace.h>
+#include <litmus/trace.h>
+
+/* Feather-Trace overhead timestamps of the scheduler/MemGuard coupling.
+ * The MemGuard side is measured inside the exported functions, so every
+ * caller is covered. Recorded with interrupts off, as all callers hold a
+ * plugin lock (or run in finish_switch). */
+#define TS_MEMBW_CUR_START		CPU_TIMESTAMP(160)	/* get_cur_budget() */
+#define TS_MEMBW_CUR_END		CPU_TIMESTAMP(161)
+#define TS_MEMBW_GRANT_START		CPU_TIMESTAMP(162)	/* get_membudget*() */
+#define TS_MEMBW_GRANT_END		CPU_TIMESTAMP(163)
+#define TS_MEMBW_CLEAN_START		CPU_TIMESTAMP(164)	/* clean_budget() */
+#define TS_MEMBW_CLEAN_END		CPU_TIMESTAMP(165)
+#define TS_MEMBW_PREEMPT_START		CPU_TIMESTAMP(166)	/* bandwidth-aware */
+#define TS_MEMBW_PREEMPT_END		CPU_TIMESTAMP(167)	/* check_for_preemptions() */
+#define TS_MEMBW_APPLY_START		CPU_TIMESTAMP(168)	/* memguard_apply_budget() */
+#define TS_MEMBW_APPLY_END		CPU_TIMESTAMP(169)
+
+/* limit (MB/s) of a core without a linked job, see clean_budget() */
+#define IDLE_BUDGET_MB			100
+
+/* program the limit of a core / give it back to the pool */
+extern int get_membudget(int get_cpu, int get_membudget);
+extern int get_membudget_rw(int cpu, int rd_mb, int wr_mb);
+extern int get_membudget_bps(int cpu, u64 rd_bps, u64 wr_bps);
+extern int clean_budget(int g_cpu);
+
+/* limits of one core in a batch, see get_membudget_batch() */
+struct memguard_grant {
+	u64 rd_bps;
+	u64 wr_bps;
+};
+
+/* program the cores in cpus at once; grants is indexed by CPU */
+extern int get_membudget_batch(const struct cpumask *cpus,
+			       const struct memguard_grant *grants);
+
+/* limit (MB/s) a core is charged for */
+extern int memguard_core_limit(int cpu);
+
+/* remaining bandwidth of the system-wide pool 0 */
+extern int get_cur_budget(void);
+
+/* total bandwidth MemGuard may hand out (g_budget_max_bw) */
+extern int memguard_max_bw(void);
+
+/* called from finish_switch: charge the events of the local core to prev,
+ * regulate current against what its job already used in this period (on
+ * any core), apply the limit posted for the core without waiting for a
+ * period and publish the core's state in current's control page */
+extern void memguard_apply_budget(struct task_struct *prev);
+
+/* aggregate the usage of all cores on cpu (the release master) instead of
+ * on every core; NO_CPU to undo */
+extern void memguard_set_housekeeping(int cpu);
+
+/* charge the events of a core to the core rather than to the running job,
+ * for plugins whose jobs share the limit of their core; reset with the
+ * pools */
+extern void memguard_set_shared_limit(int shared);
+
+/* per-cluster bandwidth pools */
+extern int memguard_pool_budget(int pool);
+extern int memguard_setup_pool(int pool, const struct cpumask *cpus);
+extern void memguard_reset_pools(void);
+
+/* Scheduler-integrated throttling. Both callbacks run in interrupt context
+ * on the core in question. throttle() returns nonzero if the plugin took the
+ * job that exhausted the core's budget off the core; otherwise MemGuard
+ * falls back to its kthrottle thread. unthrottle() is called at the start of
+ * the next period on a core that was throttled by the plugin.
+ */
+struct memguard_sched_ops {
+	int (*throttle)(int cpu);
+	void (*unthrottle)(int cpu);
+};
+
+extern void memguard_register_sched_ops(struct memguard_sched_ops *ops);
+
+/* default bandwidth of tasks that leave rt_task.mem_budget_task at 0 */
+#define DEFAULT_MEM_BUDGET_MB	100
+
+/* largest byte budget per period membw_bps() converts without overflow */
+#define MEMBW_MAX_BYTES		(U64_MAX / USEC_PER_SEC)
+
+/* bytes/s of a budget of bytes per period_us */
+static inline u64 membw_bps(u64 bytes, unsigned int period_us)
+{
+	return div_u64(bytes * USEC_PER_SEC, period_us);
+}
+
+/* MB/s, rounded up, as accounted by admission control and the pools */
+static inline int membw_bps_to_mb(u64 bps)
+{
+	return (int)DIV_ROUND_UP_ULL(bps, 1 << 20);
+}
+
+/* Write bandwidth (MB/s) of t, for admission control. */
+static inline int task_wr_mem_budget(struct task_struct *t)
+{
+	struct rt_task *tp = &tsk_rt(t)->task_params;
+
+	return membw_bps_to_mb(membw_bps(tp->mem_wr_bytes, tp->mem_period_us));
+}
+
+/* Memory bandwidth (MB/s) requested by the current job of t. This is cached
+ * in the job parameters at release time so that scheduling decisions never
+ * have to look up the task parameters under a plugin's ready lock.
+ */
+static inline int job_mem_budget(struct task_struct *t)
+{
+	return tsk_rt(t)->job_params.mem_budget_job;
+}
+
+/* setup_job_mem_budget - latch the memory budget of a newly released job
+ *
+ * A job may ask for a different budget through its control page. The request
+ * is untrusted; it is bounded by the task's mem_budget_task, which is what
+ * admission control accounted for.
+ */
+static inline void setup_job_mem_budget(struct task_struct *t)
+{
+	struct rt_task *tp = &tsk_rt(t)->task_params;
+	int mb = tp->mem_budget_task;
+	u64 rd_bps = membw_bps(tp->mem_rd_bytes, tp->mem_period_us);
+	int req = 0;
+
+	if (tsk_rt(t)->ctrl_page)
+		req = READ_ONCE(tsk_rt(t)->ctrl_page->mem_budget_req);
+	if (req > 0 && req < mb) {
+		mb = req;
+		rd_bps = min(rd_bps, (u64)req << 20);
+	}
+
+	tsk_rt(t)->job_params.mem_budget_job = mb;
+	tsk_rt(t)->job_params.mem_rd_bps = rd_bps;
+	tsk_rt(t)->job_params.mem_wr_bps =
+		membw_bps(tp->mem_wr_bytes, tp->mem_period_us);
+	tsk_rt(t)->job_params.mem_burst = tp->mem_burst_bytes;
+	/* a new job starts with a budget of its own */
+	tsk_rt(t)->job_params.mem_used = 0;
+	tsk_rt(t)->job_params.mem_wr_used = 0;
+	tsk_rt(t)->job_params.mem_period = 0;
+}
+
+/* grant_job_membudget - program cpu with the read and write budgets of t;
+ *                       avail is the remaining bandwidth of the pool cpu
+ *                       draws from, as recorded in the trace
+ */
+static inline void grant_job_membudget(int cpu, struct task_struct *t,
+				       int avail)
+{
+	sched_trace_mem_grant(t, cpu, avail);
+	get_membudget_bps(cpu, tsk_rt(t)->job_params.mem_rd_bps,
+			  tsk_rt(t)->job_params.mem_wr_bps);
+}
+
+/* release_job_membudget - give the budget t holds on cpu back to the pool */
+static inline void release_job_membudget(int cpu, struct task_struct *t,
+					 int avail)
+{
+	sched_trace_mem_release(t, cpu, avail);
+	clean_budget(cpu);
+}
+
+#endif
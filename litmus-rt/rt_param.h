@@ -122,9 +122,26 @@ struct rt_task {
 	task_class_t	cls;
 	budget_policy_t  budget_policy;  /* ignored by pfair */
 	release_policy_t release_policy;
-	int		mem_budget_task; /*111111111111111111*/
+	int		mem_budget_task; /* read bandwidth (MB/s), 0: default */
+
+	/* Memory bandwidth extension, version 1. The kernel reads or writes
+	 * the fields below only if mem_budget_task is tagged with
+	 * RT_TASK_MEM_ABI, so the struct of binaries built before the
+	 * extension is never accessed past its end. Budgets are in bytes per
+	 * mem_period_us; the MB/s budget is then derived from them. */
+	unsigned long long mem_rd_bytes;
+	unsigned long long mem_wr_bytes;	/* 0: same as mem_rd_bytes */
+	unsigned long long mem_burst_bytes;	/* extra reads once per job */
+	unsigned int	mem_period_us;
 };
 
+/* Tag in the top bits of rt_task.mem_budget_task, which no MB/s budget
+ * reaches: bit 30 marks the extension, bits 24-29 hold its version. */
+#define RT_TASK_MEM_EXT		0x40000000
+#define RT_TASK_MEM_VERSION	1
+#define RT_TASK_MEM_ABI		(RT_TASK_MEM_EXT | (RT_TASK_MEM_VERSION << 24))
+#define RT_TASK_MEM_ABI_MASK	0x7f000000
+
 /* don't export internal data structures to user space (liblitmus) */
 #ifdef __KERNEL__
 
@@ -162,7 +179,23 @@ struct rt_job {
 	 * -> used for tracing sporadic tasks. */
 	lt_t	last_suspension;
 #endif
-//	int 	mem_budget_job;
+
+	/* Memory bandwidth (MB/s) requested by this job. Latched from
+	 * the control page (or task_params.mem_budget_task) when the job
+	 * is released. */
+	int	mem_budget_job;
+	/* Read and write limits (bytes/s) MemGuard is programmed with for
+	 * this job, from the byte budgets of task_params. */
+	u64	mem_rd_bps;
+	u64	mem_wr_bps;
+	/* Burst allowance (bytes) the job has not spent yet. */
+	u64	mem_burst;
+	/* MemGuard events (reads/writes) this job consumed in the MemGuard
+	 * period that started at mem_period (ns), summed over all cores it
+	 * ran on. Charged by MemGuard at context switches. */
+	u64	mem_used;
+	u64	mem_wr_used;
+	s64	mem_period;
 };
 
 struct pfair_param;
@@ -181,6 +214,12 @@ struct rt_param {
 	/* has the task completed? */
 	unsigned int		completed:1;
 
+	/* is the released job waiting for memory bandwidth? */
+	unsigned int		bw_blocked:1;
+
+	/* did the job exhaust its memory budget in this MemGuard period? */
+	unsigned int		bw_depleted:1;
+
 #ifdef CONFIG_LITMUS_LOCKING
 	/* Is the task being priority-boosted by a locking protocol? */
 	unsigned int		priority_boosted:1;
@@ -12,6 +12,8 @@
 #include <linux/percpu.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 
 #include <litmus/debug_trace.h>
 #include <litmus/litmus.h>
@@ -26,6 +28,7 @@
 #include <litmus/np.h>
 
 #include <litmus/bheap.h>
+#include <litmus/membw.h>
 
 #ifdef CONFIG_SCHED_CPU_AFFINITY
 #include <litmus/affinity.h>
@@ -118,6 +121,9 @@ typedef struct  {
 	struct task_struct*	linked;		/* only RT tasks */
 	struct task_struct*	scheduled;	/* only RT tasks */
 	struct bheap_node*	hn;
+	/* jobs that exhausted their memory budget on this CPU, until its next
+	 * MemGuard period */
+	struct bheap		depleted;
 
 //	int 			cur_budget;    /* currently available budget */
 //	int 			mem_master;	/* memguard master cpu*/
@@ -134,13 +140,25 @@ static struct bheap      gsnedf_cpu_heap;
 
 static rt_domain_t gsnedf;
 #define gsnedf_lock (gsnedf.ready_lock)
+
+/* released jobs whose memory budget does not fit into the remaining
+ * bandwidth wait in here (EDF order) until bandwidth is given back */
+static struct bheap      gsnedf_bw_queue;
+
+/* Budget grants of a release, collected while the jobs are linked and
+ * programmed into MemGuard in one batch by gsnedf_flush_grants(). delta is
+ * the bandwidth (MB/s) the collected grants take from the pool, so that
+ * bw_fits() sees them before they reach the ledger. Protected by gsnedf_lock.
+ */
+static struct {
+	int			active;
+	int			delta;
+	int			mb[NR_CPUS];
+	struct memguard_grant	grant[NR_CPUS];
+	struct cpumask		cpus;
+} gsnedf_grants;
 static void gsnedf_task_block(struct task_struct *t);
-asmlinkage long sys_get_rt_task_param(pid_t pid, struct rt_task __user * param);
-extern int get_membudget(int get_cpu,int get_membudget);
-extern int get_master;
-extern int clean_budget(int g_cpu);
-extern int get_cur_budget(void);
-//extern int get_taskbudget;
+static void gsnedf_admit_release(struct task_struct *t);
 
 /* Uncomment this if you want to see all scheduling decisions in the
  * TRACE() log.
@@ -252,6 +270,18 @@ static noinline void unlink(struct task_struct* t)
 		entry = &per_cpu(gsnedf_cpu_entries, t->rt_param.linked_on);
 		t->rt_param.linked_on = NO_CPU;
 		link_task_to_cpu(NULL, entry);
+	} else if (tsk_rt(t)->bw_blocked) {
+		/* waiting for memory bandwidth, not in the ready queue */
+		bheap_delete(edf_ready_order, &gsnedf_bw_queue,
+			     tsk_rt(t)->heap_node);
+		tsk_rt(t)->bw_blocked = 0;
+	} else if (tsk_rt(t)->bw_depleted) {
+		/* throttled by MemGuard until the next period; a parked
+		 * job does not run, so task_cpu() is where it was throttled */
+		entry = &per_cpu(gsnedf_cpu_entries, task_cpu(t));
+		bheap_delete(edf_ready_order, &entry->depleted,
+			     tsk_rt(t)->heap_node);
+		tsk_rt(t)->bw_depleted = 0;
 	} else if (is_queued(t)) {
 		/* This is an interesting situation: t is scheduled,
 		 * but was just recently unlinked.  It cannot be
@@ -307,16 +337,92 @@ static cpu_entry_t* gsnedf_get_nearest_available_cpu(cpu_entry_t *start)
 }
 #endif
 
+/* bw_fits - does the memory budget of t fit into the remaining bandwidth? */
+static int bw_fits(struct task_struct *t)
+{
+	return job_mem_budget(t) <= get_cur_budget() - gsnedf_grants.delta;
+}
+
+/* gsnedf_grant - program cpu with the memory budget of t, or collect the
+ *                grant if a batch is open. Caller must hold gsnedf_lock.
+ */
+static void gsnedf_grant(int cpu, struct task_struct *t)
+{
+	int old;
+
+	if (!gsnedf_grants.active) {
+		grant_job_membudget(cpu, t, get_cur_budget());
+		return;
+	}
+	sched_trace_mem_grant(t, cpu, get_cur_budget() - gsnedf_grants.delta);
+	if (cpumask_test_and_set_cpu(cpu, &gsnedf_grants.cpus))
+		old = gsnedf_grants.mb[cpu];
+	else
+		old = memguard_core_limit(cpu);
+	gsnedf_grants.mb[cpu] = job_mem_budget(t);
+	gsnedf_grants.delta += gsnedf_grants.mb[cpu] - old;
+	gsnedf_grants.grant[cpu].rd_bps = tsk_rt(t)->job_params.mem_rd_bps;
+	gsnedf_grants.grant[cpu].wr_bps = tsk_rt(t)->job_params.mem_wr_bps;
+}
+
+/* link_and_grant - link t to entry and grant the job that ends up on each
+ *                  CPU involved: t may be swapped onto the CPU it is
+ *                  already scheduled on, and the job linked there onto
+ *                  entry. Caller must hold gsnedf_lock.
+ */
+static void link_and_grant(struct task_struct *t, cpu_entry_t *entry)
+{
+	link_task_to_cpu(t, entry);
+	gsnedf_grant(tsk_rt(t)->linked_on, t);
+	if (entry->linked && entry->linked != t)
+		gsnedf_grant(entry->cpu, entry->linked);
+	smp_mb();
+}
+
+/* gsnedf_flush_grants - program the collected grants. The CPUs they are for
+ *                       cannot reschedule before gsnedf_lock is dropped, so
+ *                       they all find their limit posted in finish_switch.
+ */
+static void gsnedf_flush_grants(void)
+{
+	if (!cpumask_empty(&gsnedf_grants.cpus))
+		get_membudget_batch(&gsnedf_grants.cpus, gsnedf_grants.grant);
+	cpumask_clear(&gsnedf_grants.cpus);
+	gsnedf_grants.delta = 0;
+	gsnedf_grants.active = 0;
+}
+
+/* bw_block - park a released job whose memory budget does not fit until
+ *            bandwidth is released. Caller must hold gsnedf_lock.
+ */
+static void bw_block(struct task_struct *t)
+{
+	sched_trace_mem_deny(t, NO_CPU, get_cur_budget());
+	tsk_rt(t)->bw_blocked = 1;
+	bheap_insert(edf_ready_order, &gsnedf_bw_queue, tsk_rt(t)->heap_node);
+}
+
+/* __take_ready_bw - take the highest-priority ready job whose memory budget
+ *                   fits, parking the ones that do not on the way.
+ *                   Caller must hold gsnedf_lock.
+ */
+static struct task_struct* __take_ready_bw(void)
+{
+	struct task_struct *t;
+
+	while ((t = __take_ready(&gsnedf)) && !bw_fits(t))
+		bw_block(t);
+	return t;
+}
+
 /* check for any necessary preemptions */
-static void check_for_preemptions(void)
+static void __check_for_preemptions(void)
 {
 	struct task_struct *task;
 	cpu_entry_t *last;
-	struct rt_task task_params;
-	int cur_budget;
 #ifdef CONFIG_PREFER_LOCAL_LINKING
 	cpu_entry_t *local;
-	//get_edf();
+
 	/* Before linking to other CPUs, check first whether the local CPU is
 	 * idle. */
 	local = this_cpu_ptr(&gsnedf_cpu_entries);
@@ -326,48 +432,29 @@ static void check_for_preemptions(void)
 #ifdef CONFIG_RELEASE_MASTER
 	    && likely(local->cpu != gsnedf.release_master)
 #endif
-//	   && local->cpu!=get_master  
 		) {
-		task = __take_ready(&gsnedf);
-		TRACE_TASK(task, "linking to local CPU %d to avoid IPI\n", local->cpu);
-		task_params =task->rt_param.task_params;
-		sys_get_rt_task_param(task->pid,&task_params);	
-		TRACE_TASK(task,"check preempt membudget==%d\n",task_params.mem_budget_task);
-//		get_membudget(local->cpu,task_params.mem_budget_task);		
-		
-		cur_budget=get_cur_budget();
-		TRACE_TASK(task, "get curbudget==%d\n", cur_budget);
-//		get_edf(local);
-		
-		if(task_params.mem_budget_task>cur_budget){
-
-/*			smp_mb();
-			get_membudget(local->cpu,task_params.mem_budget_task);
-			TRACE_TASK(task,"task_budget%d>cur_budget%d\n"
-				,task_params.mem_budget_task,local->cur_budget);*/
-//			gsnedf_task_block(task);
-			 TRACE_TASK(task, "task budget%d>cur_budget%d\n"
-			,task_params.mem_budget_task, cur_budget);
-//			__add_release(&gsnedf, task);
-			__add_ready(&gsnedf, task);
-
-		}else{
-			get_membudget(local->cpu,task_params.mem_budget_task);
-			smp_mb();			
-			link_task_to_cpu(task, local);
+		task = __take_ready_bw();
+		if (task) {
+			TRACE_TASK(task, "linking to local CPU %d to avoid IPI\n",
+				   local->cpu);
+			link_and_grant(task, local);
 			preempt(local);
 		}
-
 	}
 #endif
 
 	for (last = lowest_prio_cpu();
 	     edf_preemption_needed(&gsnedf, last->linked);
 	     last = lowest_prio_cpu()) {
-//&& last->cpu!=get_master
 		/* preemption necessary */
-//		smp_call_function_single(last->cpu,__get_edf,NULL,0);
 		task = __take_ready(&gsnedf);
+		if (!bw_fits(task)) {
+			/* Does not fit: let later-deadline jobs have a go. Each
+			 * job is parked at most once, so this loop is bounded
+			 * by the length of the ready queue. */
+			bw_block(task);
+			continue;
+		}
 		TRACE("check_for_preemptions: attempting to link task %d to %d\n",
 		      task->pid, last->cpu);
 
@@ -385,36 +472,111 @@ static void check_for_preemptions(void)
 		if (requeue_preempted_job(last->linked))
 			requeue(last->linked);
 #endif
-		task_params =task->rt_param.task_params;
-		sys_get_rt_task_param(task->pid,&task_params);	
-		TRACE_TASK(task,"check preempt membudget==%d\n",task_params.mem_budget_task);
-		
-//		get_membudget(last->cpu,task_params.mem_budget_task);		
+		link_and_grant(task, last);
+		preempt(last);
+	}
+}
 
-		cur_budget=get_cur_budget();
-		TRACE_TASK(task, "get curbudget==%d\n", cur_budget);	
-//		get_edf(last);
-		
-		if(task_params.mem_budget_task>cur_budget){
-//			gsnedf_task_block(task);
-		        TRACE_TASK(task, "task budget%d>cur_budget%d\n"
-			,task_params.mem_budget_task, cur_budget);				
-//			__add_release(&gsnedf, task);
-			__add_ready(&gsnedf, task);	
-/*			smp_mb();		
-                        get_membudget(last->cpu,task_params.mem_budget_task);
-                	TRACE_TASK(task,"task_budget%d>cur_budget%d\n"
-				,task_params.mem_budget_task,last->cur_budget);*/
-
-		}else{
-			get_membudget(last->cpu,task_params.mem_budget_task);		
-			smp_mb();
-                        link_task_to_cpu(task, last);
-                        preempt(last);
-                }
+static void check_for_preemptions(void)
+{
+	TS_MEMBW_PREEMPT_START;
+	__check_for_preemptions();
+	TS_MEMBW_PREEMPT_END;
+}
+
+/* __bw_release - move the jobs waiting for memory bandwidth back to the
+ *                ready queue. Caller must hold gsnedf_lock.
+ */
+static void __bw_release(void)
+{
+	struct bheap_node *hn;
+	struct task_struct *t;
+
+	while ((hn = bheap_take(edf_ready_order, &gsnedf_bw_queue))) {
+		t = bheap2task(hn);
+		tsk_rt(t)->bw_blocked = 0;
+		__add_ready(&gsnedf, t);
+	}
+}
+
+/* bw_release - memory bandwidth was given back; move the jobs waiting for
+ *              bandwidth back to the ready queue and re-check preemptions.
+ *              Caller must hold gsnedf_lock.
+ */
+static void bw_release(void)
+{
+	if (bheap_empty(&gsnedf_bw_queue))
+		return;
+
+	__bw_release();
+	check_for_preemptions();
+}
+
+/* gsnedf_bw_throttle - MemGuard callback: the budget of cpu is exhausted.
+ *                      Take the job linked there off the CPU until the next
+ *                      period and give the CPU to other work. Called in
+ *                      interrupt context on cpu.
+ */
+static int gsnedf_bw_throttle(int cpu)
+{
+	cpu_entry_t *entry = &per_cpu(gsnedf_cpu_entries, cpu);
+	struct task_struct *t;
+
+	raw_spin_lock(&gsnedf_lock);
+	t = entry->linked;
+	/* Only a running, preemptable real-time job can be parked; anything
+	 * else is left to the kthrottle thread. */
+	if (!t || t != entry->scheduled || is_np(t)) {
+		raw_spin_unlock(&gsnedf_lock);
+		return 0;
 	}
+
+	sched_trace_mem_throttle(t, cpu, get_cur_budget());
+	unlink(t);
+	tsk_rt(t)->bw_depleted = 1;
+	bheap_insert(edf_ready_order, &entry->depleted,
+		     tsk_rt(t)->heap_node);
+	clean_budget(cpu);
+
+	/* the grant of t is back in the pool: waiting jobs may fit now, and
+	 * cpu is free for the highest-priority ready job */
+	__bw_release();
+	check_for_preemptions();
+	preempt(entry);
+
+	raw_spin_unlock(&gsnedf_lock);
+	return 1;
 }
 
+/* gsnedf_bw_unthrottle - MemGuard callback: a new period started on cpu,
+ *                        the jobs depleted there may compete for CPUs
+ *                        again. MemGuard keeps the timer of a core that
+ *                        throttled running, so every such core gets here.
+ */
+static void gsnedf_bw_unthrottle(int cpu)
+{
+	cpu_entry_t *entry = &per_cpu(gsnedf_cpu_entries, cpu);
+	struct bheap_node *hn;
+	struct task_struct *t;
+
+	raw_spin_lock(&gsnedf_lock);
+	if (!bheap_empty(&entry->depleted)) {
+		while ((hn = bheap_take(edf_ready_order, &entry->depleted))) {
+			t = bheap2task(hn);
+			tsk_rt(t)->bw_depleted = 0;
+			sched_trace_mem_unthrottle(t, cpu, get_cur_budget());
+			__add_ready(&gsnedf, t);
+		}
+		check_for_preemptions();
+	}
+	raw_spin_unlock(&gsnedf_lock);
+}
+
+static struct memguard_sched_ops gsnedf_memguard_ops = {
+	.throttle	= gsnedf_bw_throttle,
+	.unthrottle	= gsnedf_bw_unthrottle,
+};
+
 /* gsnedf_job_arrival: task is either resumed or released */
 static noinline void gsnedf_job_arrival(struct task_struct* task)
 {
@@ -430,8 +592,12 @@ static void gsnedf_release_jobs(rt_domain_t* rt, struct bheap* tasks)
 
 	raw_spin_lock_irqsave(&gsnedf_lock, flags);
 
+	/* With a synchronous release (release_ts) all first jobs arrive here
+	 * together: link them all first, then program MemGuard once. */
+	gsnedf_grants.active = 1;
 	__merge_ready(rt, tasks);
 	check_for_preemptions();
+	gsnedf_flush_grants();
 
 	raw_spin_unlock_irqrestore(&gsnedf_lock, flags);
 }
@@ -441,7 +607,10 @@ static noinline void curr_job_completion(int forced)
 {
 	struct task_struct *t = current;
 	BUG_ON(!t);
-	clean_budget(smp_processor_id());
+	/* a job parked by gsnedf_bw_throttle() no longer owns this CPU's grant */
+	if (tsk_rt(t)->linked_on != NO_CPU)
+		release_job_membudget(tsk_rt(t)->linked_on, t,
+				      get_cur_budget());
 	sched_trace_task_completion(t, forced);
 
 	TRACE_TASK(t, "job_completion(forced=%d).\n", forced);
@@ -450,6 +619,7 @@ static noinline void curr_job_completion(int forced)
 	tsk_rt(t)->completed = 0;
 	/* prepare for next period */
 	prepare_for_next_period(t);
+	setup_job_mem_budget(t);
 	if (is_early_releasing(t) || is_released(t, litmus_clock()))
 		sched_trace_task_release(t);
 	/* unlink */
@@ -458,6 +628,8 @@ static noinline void curr_job_completion(int forced)
 	 * But don't requeue a blocking task. */
 	if (is_current_running())
 		gsnedf_job_arrival(t);
+	/* the budget of the completed job is available again */
+	bw_release();
 }
 
 /* Getting schedule() right is a bit tricky. schedule() may not make any
@@ -486,7 +658,7 @@ static struct task_struct* gsnedf_schedule(struct task_struct * prev)
 	cpu_entry_t* entry = this_cpu_ptr(&gsnedf_cpu_entries);
 	int out_of_time, sleep, preempt, np, exists, blocks;
 	struct task_struct* next = NULL;
-	struct rt_task task_params;
+	struct task_struct* ready;
 #ifdef CONFIG_RELEASE_MASTER
 	/* Bail out early if we are the release master.
 	 * The release master never schedules any real-time tasks.
@@ -513,20 +685,16 @@ static struct task_struct* gsnedf_schedule(struct task_struct * prev)
 	np 	    = exists && is_np(entry->scheduled);
 	sleep	    = exists && is_completed(entry->scheduled);
 	preempt     = entry->scheduled != entry->linked;
-	task_params = prev->rt_param.task_params;
-//	runout	    = entry->cur_budget<task_params.mem_budget_task;
 #ifdef WANT_ALL_SCHED_EVENTS
 	TRACE_TASK(prev, "invoked gsnedf_schedule.\n");
 #endif
 
 	if (exists){
-		sys_get_rt_task_param(prev->pid,&task_params);
-		
 		TRACE_TASK(prev,
 			   "blocks:%d out_of_time:%d np:%d sleep:%d preempt:%d "
 			   "state:%d sig:%d,membudget=%dMb/s\n",
 			   blocks, out_of_time, np, sleep, preempt,
-			   prev->state, signal_pending(prev),task_params.mem_budget_task);
+			   prev->state, signal_pending(prev), job_mem_budget(prev));
 /*		if(entry->cur_budget<entry->task_budget){
 			TRACE_TASK(prev,"entry->cur_budget<task_budget\n");
 			unlink(prev);
@@ -565,8 +733,17 @@ static struct task_struct* gsnedf_schedule(struct task_struct * prev)
 
 	/* Link pending task if we became unlinked.
 	 */
-	if (!entry->linked)
-		link_task_to_cpu(__take_ready(&gsnedf), entry);
+	if (!entry->linked) {
+		ready = __take_ready_bw();
+		if (ready)
+			link_and_grant(ready, entry);
+		/* ready may have been swapped onto the CPU it runs on */
+		if (!entry->linked) {
+			/* going idle: hand the core's bandwidth back */
+			clean_budget(entry->cpu);
+			bw_release();
+		}
+	}
 
 	/* The final scheduling decision. Do we need to switch for some reason?
 	 * If linked is different from scheduled, then select linked as next.
@@ -616,6 +793,9 @@ static void gsnedf_finish_switch(struct task_struct *prev)
 	cpu_entry_t* 	entry = this_cpu_ptr(&gsnedf_cpu_entries);
 
 	entry->scheduled = is_realtime(current) ? current : NULL;
+	/* program the budget posted for this core by the last link; the
+	 * events prev used so far go with its job to its next core */
+	memguard_apply_budget(prev);
 #ifdef WANT_ALL_SCHED_EVENTS
 	TRACE_TASK(prev, "switched away from\n");
 #endif
@@ -635,6 +815,7 @@ static void gsnedf_task_new(struct task_struct * t, int on_rq, int is_scheduled)
 
 	/* setup job params */
 	release_at(t, litmus_clock());
+	setup_job_mem_budget(t);
 
 	if (is_scheduled) {
 		entry = &per_cpu(gsnedf_cpu_entries, task_cpu(t));
@@ -673,6 +854,7 @@ static void gsnedf_task_wake_up(struct task_struct *task)
 	now = litmus_clock();
 	if (is_sporadic(task) && is_tardy(task, now)) {
 		inferred_sporadic_job_release_at(task, now);
+		setup_job_mem_budget(task);
 	}
 	gsnedf_job_arrival(task);
 	raw_spin_unlock_irqrestore(&gsnedf_lock, flags);
@@ -684,9 +866,14 @@ static void gsnedf_task_block(struct task_struct *t)
 
 	TRACE_TASK(t, "block at %llu\n", litmus_clock());
 
-	/* unlink if necessary */
+	/* unlink if necessary; a sleeping job holds no bandwidth, it is
+	 * granted again when the job is linked after waking up */
 	raw_spin_lock_irqsave(&gsnedf_lock, flags);
+	if (tsk_rt(t)->linked_on != NO_CPU)
+		release_job_membudget(tsk_rt(t)->linked_on, t,
+				      get_cur_budget());
 	unlink(t);
+	bw_release();
 	raw_spin_unlock_irqrestore(&gsnedf_lock, flags);
 
 	BUG_ON(!is_realtime(t));
@@ -696,25 +883,171 @@ static void gsnedf_task_block(struct task_struct *t)
 static void gsnedf_task_exit(struct task_struct * t)
 {
 	unsigned long flags;
-	clean_budget(smp_processor_id());
+
 	/* unlink if necessary */
 	raw_spin_lock_irqsave(&gsnedf_lock, flags);
+	if (tsk_rt(t)->linked_on != NO_CPU)
+		release_job_membudget(tsk_rt(t)->linked_on, t,
+				      get_cur_budget());
 	unlink(t);
 	if (tsk_rt(t)->scheduled_on != NO_CPU) {
 		gsnedf_cpus[tsk_rt(t)->scheduled_on]->scheduled = NULL;
 		tsk_rt(t)->scheduled_on = NO_CPU;
 	}
+	bw_release();
 
 	raw_spin_unlock_irqrestore(&gsnedf_lock, flags);
 
+	gsnedf_admit_release(t);
+
 	BUG_ON(!is_realtime(t));
         TRACE_TASK(t, "RIP\n");
 }
 
 
+/* Admission control.
+ *
+ * A task set is admitted if it passes the GFB density bound
+ *
+ *	sum(delta_i) <= m - (m - 1) * max(delta_i)
+ *
+ * over the m real-time CPUs and if its total memory bandwidth fits into
+ * what MemGuard can hand out (g_budget_max_bw) less IDLE_BUDGET_MB for every
+ * online CPU. Each core is charged either the budget of its linked job or
+ * IDLE_BUDGET_MB (the release master always the latter, see
+ * gsnedf_activate_plugin()), so under this bound no set of concurrently
+ * linked jobs is ever held back by bw_fits() and the density bound is not
+ * invalidated by bandwidth blocking. The bound is sufficient, not necessary,
+ * hence tasks that fail it are only flagged by default.
+ *
+ * Densities are kept in DENSITY_SCALE fixed point. max_density is a
+ * high-water mark that is only reset once all admitted tasks are gone, which
+ * is pessimistic but avoids keeping a list of admitted tasks.
+ */
+#define DENSITY_SCALE	1000
+
+typedef enum {
+	GSNEDF_ADMIT_OFF,	/* admit everything (legacy behaviour) */
+	GSNEDF_ADMIT_WARN,	/* admit, but flag tasks that fail the test */
+	GSNEDF_ADMIT_ENFORCE,	/* reject tasks that fail the test */
+} gsnedf_admit_mode_t;
+
+static const char* gsnedf_admit_mode_names[] = {
+	[GSNEDF_ADMIT_OFF]	= "off",
+	[GSNEDF_ADMIT_WARN]	= "warn",
+	[GSNEDF_ADMIT_ENFORCE]	= "enforce",
+};
+
+static struct {
+	gsnedf_admit_mode_t	mode;
+	unsigned int		num_tasks;
+	unsigned long		density;	/* DENSITY_SCALE-based */
+	unsigned long		max_density;	/* DENSITY_SCALE-based */
+	int			mem_budget;	/* MB/s */
+	unsigned int		flagged;	/* admitted despite failing */
+	unsigned int		rejected;
+} gsnedf_admitted = {
+	.mode = GSNEDF_ADMIT_WARN,
+};
+
+/* protects gsnedf_admitted */
+static DEFINE_RAW_SPINLOCK(gsnedf_admit_lock);
+
+static unsigned long task_density(struct task_struct *t)
+{
+	lt_t e = get_exec_cost(t) * DENSITY_SCALE;
+
+	do_div(e, min(get_rt_relative_deadline(t), get_rt_period(t)));
+	return (unsigned long) e;
+}
+
+static int gsnedf_num_rt_cpus(void)
+{
+	int cpus = num_online_cpus();
+
+#ifdef CONFIG_RELEASE_MASTER
+	if (gsnedf.release_master != NO_CPU)
+		cpus--;
+#endif
+	return cpus;
+}
+
+/* bandwidth left to real-time jobs once every core is charged as idle */
+static int gsnedf_mem_capacity(void)
+{
+	return memguard_max_bw() - num_online_cpus() * IDLE_BUDGET_MB;
+}
+
+/* gsnedf_admissible - would the admitted set plus a task of the given density
+ *                     and bandwidth still pass the test?
+ *                     Caller must hold gsnedf_admit_lock.
+ */
+static int gsnedf_admissible(unsigned long density, int mem_budget)
+{
+	unsigned long m = gsnedf_num_rt_cpus();
+	unsigned long dmax = max(gsnedf_admitted.max_density, density);
+
+	if (density > DENSITY_SCALE)
+		return 0;
+	if (gsnedf_admitted.density + density >
+	    m * DENSITY_SCALE - (m - 1) * dmax)
+		return 0;
+	return gsnedf_admitted.mem_budget + mem_budget <= gsnedf_mem_capacity();
+}
+
 static long gsnedf_admit_task(struct task_struct* tsk)
 {
-	return 0;
+	unsigned long flags;
+	unsigned long density = task_density(tsk);
+	int mem_budget = tsk_rt(tsk)->task_params.mem_budget_task;
+	long ret = 0;
+
+	raw_spin_lock_irqsave(&gsnedf_admit_lock, flags);
+
+	if (gsnedf_admitted.mode != GSNEDF_ADMIT_OFF &&
+	    !gsnedf_admissible(density, mem_budget)) {
+		printk(KERN_INFO "GSN-EDF: task %d (d=%lu/%d, bw=%d MB/s) %s: "
+		       "admitted d=%lu, bw=%d/%d MB/s\n", tsk->pid, density,
+		       DENSITY_SCALE, mem_budget,
+		       gsnedf_admitted.mode == GSNEDF_ADMIT_ENFORCE ?
+		       "rejected" : "not schedulable",
+		       gsnedf_admitted.density, gsnedf_admitted.mem_budget,
+		       gsnedf_mem_capacity());
+		if (gsnedf_admitted.mode == GSNEDF_ADMIT_ENFORCE) {
+			gsnedf_admitted.rejected++;
+			ret = -EINVAL;
+			goto out;
+		}
+		gsnedf_admitted.flagged++;
+	}
+
+	gsnedf_admitted.num_tasks++;
+	gsnedf_admitted.density    += density;
+	gsnedf_admitted.max_density = max(gsnedf_admitted.max_density, density);
+	gsnedf_admitted.mem_budget += mem_budget;
+out:
+	raw_spin_unlock_irqrestore(&gsnedf_admit_lock, flags);
+	return ret;
+}
+
+/* give an exiting task's share back to the admission test */
+static void gsnedf_admit_release(struct task_struct *t)
+{
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&gsnedf_admit_lock, flags);
+	if (gsnedf_admitted.num_tasks) {
+		gsnedf_admitted.num_tasks--;
+		gsnedf_admitted.density -= min(gsnedf_admitted.density,
+					       task_density(t));
+		gsnedf_admitted.mem_budget -= tsk_rt(t)->task_params.mem_budget_task;
+		if (!gsnedf_admitted.num_tasks) {
+			gsnedf_admitted.density     = 0;
+			gsnedf_admitted.max_density = 0;
+			gsnedf_admitted.mem_budget  = 0;
+		}
+	}
+	raw_spin_unlock_irqrestore(&gsnedf_admit_lock, flags);
 }
 
 #ifdef CONFIG_LITMUS_LOCKING
@@ -1089,6 +1422,7 @@ static long gsnedf_activate_plugin(void)
 	cpu_entry_t *entry;
 
 	bheap_init(&gsnedf_cpu_heap);
+	bheap_init(&gsnedf_bw_queue);
 #ifdef CONFIG_RELEASE_MASTER
 	gsnedf.release_master = atomic_read(&release_master_cpu);
 #endif
@@ -1096,6 +1430,7 @@ static long gsnedf_activate_plugin(void)
 	for_each_online_cpu(cpu) {
 		entry = &per_cpu(gsnedf_cpu_entries, cpu);
 		bheap_node_init(&entry->hn, entry);
+		bheap_init(&entry->depleted);
 		entry->linked    = NULL;
 		entry->scheduled = NULL;
 #ifdef CONFIG_RELEASE_MASTER
@@ -1113,15 +1448,95 @@ static long gsnedf_activate_plugin(void)
 
 	gsnedf_setup_domain_proc();
 
+	/* all cores draw from the single system-wide bandwidth pool; none
+	 * keeps the share it was charged at boot or by the previous plugin */
+	memguard_reset_pools();
+	for_each_online_cpu(cpu)
+		clean_budget(cpu);
+	memguard_register_sched_ops(&gsnedf_memguard_ops);
+#ifdef CONFIG_RELEASE_MASTER
+	/* MemGuard's bookkeeping joins the timer interrupts on the release
+	 * master, away from the CPUs that run real-time jobs */
+	memguard_set_housekeeping(gsnedf.release_master);
+#endif
+
+	/* nothing is admitted across a plugin switch */
+	gsnedf_admitted.num_tasks   = 0;
+	gsnedf_admitted.density     = 0;
+	gsnedf_admitted.max_density = 0;
+	gsnedf_admitted.mem_budget  = 0;
+
 	return 0;
 }
 
 static long gsnedf_deactivate_plugin(void)
 {
+	memguard_register_sched_ops(NULL);
+	memguard_set_housekeeping(NO_CPU);
 	destroy_domain_proc_info(&gsnedf_domain_proc_info);
 	return 0;
 }
 
+/* /proc/litmus/plugins/GSN-EDF/admission */
+
+static int gsnedf_admission_show(struct seq_file *m, void *v)
+{
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&gsnedf_admit_lock, flags);
+	seq_printf(m, "mode:        %s\n",
+		   gsnedf_admit_mode_names[gsnedf_admitted.mode]);
+	seq_printf(m, "cpus:        %d\n", gsnedf_num_rt_cpus());
+	seq_printf(m, "tasks:       %u\n", gsnedf_admitted.num_tasks);
+	seq_printf(m, "density:     %lu/%d\n", gsnedf_admitted.density,
+		   DENSITY_SCALE);
+	seq_printf(m, "max_density: %lu/%d\n", gsnedf_admitted.max_density,
+		   DENSITY_SCALE);
+	seq_printf(m, "mem_budget:  %d/%d MB/s\n", gsnedf_admitted.mem_budget,
+		   gsnedf_mem_capacity());
+	seq_printf(m, "flagged:     %u\n", gsnedf_admitted.flagged);
+	seq_printf(m, "rejected:    %u\n", gsnedf_admitted.rejected);
+	raw_spin_unlock_irqrestore(&gsnedf_admit_lock, flags);
+	return 0;
+}
+
+static int gsnedf_admission_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, gsnedf_admission_show, NULL);
+}
+
+static ssize_t gsnedf_admission_write(struct file *file,
+				      const char __user *buffer,
+				      size_t count, loff_t *ppos)
+{
+	char name[16];
+	int i;
+	ssize_t len;
+
+	len = copy_and_strip_from_user(buffer, count, name, sizeof(name));
+	if (len < 0)
+		return len;
+
+	for (i = 0; i < ARRAY_SIZE(gsnedf_admit_mode_names); i++)
+		if (!strcmp(name, gsnedf_admit_mode_names[i])) {
+			gsnedf_admitted.mode = i;
+			return count;
+		}
+
+	printk(KERN_INFO "GSN-EDF: unknown admission mode '%s'\n", name);
+	return -EINVAL;
+}
+
+static const struct file_operations gsnedf_admission_fops = {
+	.open		= gsnedf_admission_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+	.write		= gsnedf_admission_write,
+};
+
+static struct proc_dir_entry *gsnedf_dir = NULL;
+
 /*	Plugin object	*/
 static struct sched_plugin gsn_edf_plugin __cacheline_aligned_in_smp = {
 	.plugin_name		= "GSN-EDF",
@@ -1144,10 +1559,11 @@ static struct sched_plugin gsn_edf_plugin __cacheline_aligned_in_smp = {
 
 static int __init init_gsn_edf(void)
 {
-	int cpu;
+	int cpu, err;
 	cpu_entry_t *entry;
 
 	bheap_init(&gsnedf_cpu_heap);
+	bheap_init(&gsnedf_bw_queue);
 	/* initialize CPU state */
 	for (cpu = 0; cpu < NR_CPUS; cpu++)  {
 		entry = &per_cpu(gsnedf_cpu_entries, cpu);
@@ -1155,12 +1571,21 @@ static int __init init_gsn_edf(void)
 		entry->cpu 	 = cpu;
 		entry->hn        = &gsnedf_heap_node[cpu];
 		bheap_node_init(&entry->hn, entry);
+		bheap_init(&entry->depleted);
 //		entry->cur_budget= 360;
 		
 	}
 
 	edf_domain_init(&gsnedf, NULL, gsnedf_release_jobs);
-	return register_sched_plugin(&gsn_edf_plugin);
+	err = register_sched_plugin(&gsn_edf_plugin);
+	if (!err) {
+		if (!make_plugin_proc_dir(&gsn_edf_plugin, &gsnedf_dir))
+			proc_create("admission", 0644, gsnedf_dir,
+				    &gsnedf_admission_fops);
+		else
+			printk(KERN_ERR "Could not allocate GSN-EDF procfs dir.\n");
+	}
+	return err;
 }
 
 //EXPORT_SYMBOL(get_edfbudget);
@@ -0,0 +1,669 @@
+/*
+ * litmus/sched_pbw_edf.c
+ *
+ * Implementation of a bandwidth-aware partitioned EDF scheduler (PBW-EDF).
+ *
+ * Every CPU is its own EDF domain with its own lock, as in PSN-EDF. Tasks
+ * are assigned to partitions at admission time, either as requested by
+ * rt_task.cpu or by a two-dimensional bin-packing heuristic over CPU
+ * utilization and memory bandwidth (mem_budget_task). The MemGuard limit of
+ * a core is the sum of the memory budgets of the tasks assigned to it; it is
+ * programmed once when the partition changes (admission, exit), never on a
+ * scheduling decision.
+ *
+ * The heuristic is selected through /proc/litmus/plugins/PBW-EDF/partitioning:
+ *
+ *   manual     - honour rt_task.cpu (default, like PSN-EDF)
+ *   first-fit  - lowest-numbered CPU on which the task fits
+ *   worst-fit  - CPU with the most spare capacity left after placement
+ *
+ * Admission is online, so the "decreasing" variants (FFD/WFD) are obtained by
+ * launching the task set in order of decreasing utilization.
+ */
+
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/module.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+
+#include <litmus/debug_trace.h>
+#include <litmus/litmus.h>
+#include <litmus/jobs.h>
+#include <litmus/preempt.h>
+#include <litmus/budget.h>
+#include <litmus/np.h>
+#include <litmus/sched_plugin.h>
+#include <litmus/edf_common.h>
+#include <litmus/sched_trace.h>
+#include <litmus/trace.h>
+
+/* to set up domain/cpu mappings */
+#include <litmus/litmus_proc.h>
+
+#include <litmus/membw.h>
+
+/* utilization is kept in fixed point, UTIL_SCALE == one full CPU */
+#define UTIL_SCALE	1000
+
+typedef enum {
+	PBW_MANUAL,
+	PBW_FIRST_FIT,
+	PBW_WORST_FIT,
+} pbw_partitioning_t;
+
+static const char* pbw_partitioning_names[] = {
+	[PBW_MANUAL]	= "manual",
+	[PBW_FIRST_FIT]	= "first-fit",
+	[PBW_WORST_FIT]	= "worst-fit",
+};
+
+static pbw_partitioning_t partitioning = PBW_MANUAL;
+
+typedef struct {
+	rt_domain_t 		domain;
+	int          		cpu;
+	struct task_struct* 	scheduled; /* only RT tasks */
+
+	/* load admitted to this partition, protected by pbw_assign_lock */
+	unsigned int		util;		/* UTIL_SCALE-based */
+	int			mem_budget;	/* MB/s */
+	int			mem_wr_budget;	/* MB/s */
+	unsigned int		num_tasks;
+/*
+ * scheduling lock slock
+ * protects the domain and serializes scheduling decisions
+ */
+#define slock domain.ready_lock
+
+} pbw_domain_t;
+
+DEFINE_PER_CPU(pbw_domain_t, pbw_domains);
+
+/* serializes partition assignment and the per-partition load */
+static DEFINE_RAW_SPINLOCK(pbw_assign_lock);
+
+#define local_edf		(&(this_cpu_ptr(&pbw_domains)->domain))
+#define local_pedf		(this_cpu_ptr(&pbw_domains))
+#define remote_edf(cpu)		(&per_cpu(pbw_domains, cpu).domain)
+#define remote_pedf(cpu)	(&per_cpu(pbw_domains, cpu))
+#define task_edf(task)		remote_edf(get_partition(task))
+#define task_pedf(task)		remote_pedf(get_partition(task))
+
+
+static void pbw_domain_init(pbw_domain_t* pedf,
+			    check_resched_needed_t check,
+			    release_jobs_t release,
+			    int cpu)
+{
+	edf_domain_init(&pedf->domain, check, release);
+	pedf->cpu      		= cpu;
+	pedf->scheduled		= NULL;
+	pedf->util		= 0;
+	pedf->mem_budget	= 0;
+	pedf->mem_wr_budget	= 0;
+	pedf->num_tasks		= 0;
+}
+
+static void requeue(struct task_struct* t, rt_domain_t *edf)
+{
+	if (t->state != TASK_RUNNING)
+		TRACE_TASK(t, "requeue: !TASK_RUNNING\n");
+
+	tsk_rt(t)->completed = 0;
+	if (is_early_releasing(t) || is_released(t, litmus_clock()))
+		__add_ready(edf, t);
+	else
+		add_release(edf, t); /* it has got to wait */
+}
+
+/* we assume the lock is being held */
+static void preempt(pbw_domain_t *pedf)
+{
+	preempt_if_preemptable(pedf->scheduled, pedf->cpu);
+}
+
+/* This check is trivial in partioned systems as we only have to consider
+ * the CPU of the partition.
+ */
+static int pbw_preempt_check(pbw_domain_t *pedf)
+{
+	if (edf_preemption_needed(&pedf->domain, pedf->scheduled)) {
+		preempt(pedf);
+		return 1;
+	} else
+		return 0;
+}
+
+static int pbw_check_resched(rt_domain_t *edf)
+{
+	pbw_domain_t *pedf = container_of(edf, pbw_domain_t, domain);
+
+	/* because this is a callback from rt_domain_t we already hold
+	 * the necessary lock for the ready queue
+	 */
+	return pbw_preempt_check(pedf);
+}
+
+static void job_completion(struct task_struct* t, int forced)
+{
+	sched_trace_task_completion(t, forced);
+	TRACE_TASK(t, "job_completion(forced=%d).\n", forced);
+
+	tsk_rt(t)->completed = 0;
+	prepare_for_next_period(t);
+	setup_job_mem_budget(t);
+}
+
+static struct task_struct* pbw_schedule(struct task_struct * prev)
+{
+	pbw_domain_t* 		pedf = local_pedf;
+	rt_domain_t*		edf  = &pedf->domain;
+	struct task_struct*	next;
+
+	int 			out_of_time, sleep, preempt,
+				np, exists, blocks, resched;
+
+	raw_spin_lock(&pedf->slock);
+
+	/* sanity checking
+	 * differently from gedf, when a task exits (dead)
+	 * pedf->schedule may be null and prev _is_ realtime
+	 */
+	BUG_ON(pedf->scheduled && pedf->scheduled != prev);
+	BUG_ON(pedf->scheduled && !is_realtime(prev));
+
+	/* (0) Determine state */
+	exists      = pedf->scheduled != NULL;
+	blocks      = exists && !is_current_running();
+	out_of_time = exists && budget_enforced(pedf->scheduled)
+		&& budget_exhausted(pedf->scheduled);
+	np 	    = exists && is_np(pedf->scheduled);
+	sleep	    = exists && is_completed(pedf->scheduled);
+	preempt     = edf_preemption_needed(edf, prev);
+
+	/* If we need to preempt do so.
+	 * The following checks set resched to 1 in case of special
+	 * circumstances.
+	 */
+	resched = preempt;
+
+	/* If a task blocks we have no choice but to reschedule.
+	 */
+	if (blocks)
+		resched = 1;
+
+	/* Request a sys_exit_np() call if we would like to preempt but cannot.
+	 * Multiple calls to request_exit_np() don't hurt.
+	 */
+	if (np && (out_of_time || preempt || sleep))
+		request_exit_np(pedf->scheduled);
+
+	/* Any task that is preemptable and either exhausts its execution
+	 * budget or wants to sleep completes. We may have to reschedule after
+	 * this.
+	 */
+	if (!np && (out_of_time || sleep)) {
+		job_completion(pedf->scheduled, !sleep);
+		resched = 1;
+	}
+
+	/* The final scheduling decision. Do we need to switch for some reason?
+	 * Switch if we are in RT mode and have no task or if we need to
+	 * resched.
+	 */
+	next = NULL;
+	if ((!np || blocks) && (resched || !exists)) {
+		/* When preempting a task that does not block, then
+		 * re-insert it into either the ready queue or the
+		 * release queue (if it completed). requeue() picks
+		 * the appropriate queue.
+		 */
+		if (pedf->scheduled && !blocks)
+			requeue(pedf->scheduled, edf);
+		next = __take_ready(edf);
+	} else
+		/* Only override Linux scheduler if we have a real-time task
+		 * scheduled that needs to continue.
+		 */
+		if (exists)
+			next = prev;
+
+	if (next) {
+		TRACE_TASK(next, "scheduled at %llu\n", litmus_clock());
+	} else {
+		TRACE("becoming idle at %llu\n", litmus_clock());
+	}
+
+	pedf->scheduled = next;
+	sched_state_task_picked();
+	raw_spin_unlock(&pedf->slock);
+
+	return next;
+}
+
+
+/* _finish_switch - we just finished the switch away from prev
+ */
+static void pbw_finish_switch(struct task_struct *prev)
+{
+	/* the partition limit is fixed, but the tasks of a partition are
+	 * charged for their own events and the incoming task's control
+	 * page needs the core's MemGuard state */
+	memguard_apply_budget(prev);
+}
+
+/*	Prepare a task for running in RT mode
+ */
+static void pbw_task_new(struct task_struct * t, int on_rq, int is_scheduled)
+{
+	rt_domain_t* 		edf  = task_edf(t);
+	pbw_domain_t* 		pedf = task_pedf(t);
+	unsigned long		flags;
+
+	TRACE_TASK(t, "pbw edf: task new, cpu = %d\n",
+		   t->rt_param.task_params.cpu);
+
+	/* setup job parameters */
+	release_at(t, litmus_clock());
+	setup_job_mem_budget(t);
+
+	/* The task should be running in the queue, otherwise signal
+	 * code will try to wake it up with fatal consequences.
+	 */
+	raw_spin_lock_irqsave(&pedf->slock, flags);
+	if (is_scheduled && task_cpu(t) == pedf->cpu) {
+		/* there shouldn't be anything else scheduled at the time */
+		BUG_ON(pedf->scheduled);
+		pedf->scheduled = t;
+	} else {
+		/* !is_scheduled means it is not scheduled right now, but it
+		 * does not mean that it is suspended. If it is not suspended,
+		 * it still needs to be requeued. If it is suspended, there is
+		 * nothing that we need to do as it will be handled by the
+		 * wake_up() handler.
+		 *
+		 * A task that the bin-packing heuristic placed on another
+		 * partition than the one it is running on is treated the same
+		 * way; its current CPU must let go of it.
+		 */
+		if (on_rq || is_scheduled) {
+			requeue(t, edf);
+			/* maybe we have to reschedule */
+			pbw_preempt_check(pedf);
+		}
+		if (is_scheduled)
+			litmus_reschedule(task_cpu(t));
+	}
+	raw_spin_unlock_irqrestore(&pedf->slock, flags);
+}
+
+static void pbw_task_wake_up(struct task_struct *task)
+{
+	unsigned long		flags;
+	pbw_domain_t* 		pedf = task_pedf(task);
+	rt_domain_t* 		edf  = task_edf(task);
+	lt_t			now;
+
+	TRACE_TASK(task, "wake_up at %llu\n", litmus_clock());
+	raw_spin_lock_irqsave(&pedf->slock, flags);
+	BUG_ON(is_queued(task));
+	now = litmus_clock();
+	if (is_sporadic(task) && is_tardy(task, now)) {
+		inferred_sporadic_job_release_at(task, now);
+		setup_job_mem_budget(task);
+	}
+
+	/* Only add to ready queue if it is not the currently-scheduled
+	 * task. This could be the case if a task was woken up concurrently
+	 * on a remote CPU before the executing CPU got around to actually
+	 * de-scheduling the task, i.e., wake_up() raced with schedule()
+	 * and won.
+	 */
+	if (pedf->scheduled != task) {
+		requeue(task, edf);
+		pbw_preempt_check(pedf);
+	}
+
+	raw_spin_unlock_irqrestore(&pedf->slock, flags);
+	TRACE_TASK(task, "wake up done\n");
+}
+
+static void pbw_task_block(struct task_struct *t)
+{
+	/* only running tasks can block, thus t is in no queue */
+	TRACE_TASK(t, "block at %llu, state=%d\n", litmus_clock(), t->state);
+
+	BUG_ON(!is_realtime(t));
+	BUG_ON(is_queued(t));
+}
+
+/* utilization of t in UTIL_SCALE units */
+static unsigned int task_util(struct task_struct *t)
+{
+	lt_t e = get_exec_cost(t) * UTIL_SCALE;
+
+	do_div(e, get_rt_period(t));
+	return (unsigned int) e;
+}
+
+/* bandwidth capacity of a single partition (bin) */
+static int partition_bw_capacity(void)
+{
+	int cpus = num_online_cpus();
+
+#ifdef CONFIG_RELEASE_MASTER
+	if (atomic_read(&release_master_cpu) != NO_CPU)
+		cpus--;
+#endif
+	return memguard_max_bw() / max(cpus, 1);
+}
+
+/* program the MemGuard limit of a partition from its admitted load */
+static void program_partition_budget(pbw_domain_t *pedf)
+{
+	if (pedf->num_tasks)
+		get_membudget_rw(pedf->cpu, pedf->mem_budget,
+				 pedf->mem_wr_budget);
+	else
+		clean_budget(pedf->cpu);
+	TRACE("P%d: %u tasks, util=%u/%d, membudget=%d MB/s\n", pedf->cpu,
+	      pedf->num_tasks, pedf->util, UTIL_SCALE, pedf->mem_budget);
+}
+
+static int partition_fits(pbw_domain_t *pedf, unsigned int util, int bw,
+			  int bw_cap)
+{
+	return pedf->util + util <= UTIL_SCALE &&
+	       pedf->mem_budget + bw <= bw_cap;
+}
+
+/* pick_partition - choose a partition for a task with the given demand.
+ *                  Returns NO_CPU if it fits nowhere. Caller must hold
+ *                  pbw_assign_lock.
+ */
+static int pick_partition(unsigned int util, int bw)
+{
+	int cpu, best = NO_CPU;
+	long slack, best_slack = -1;
+	int bw_cap = partition_bw_capacity();
+	pbw_domain_t *pedf;
+
+	for_each_online_cpu(cpu) {
+#ifdef CONFIG_RELEASE_MASTER
+		if (cpu == remote_edf(cpu)->release_master)
+			continue;
+#endif
+		pedf = remote_pedf(cpu);
+		if (!partition_fits(pedf, util, bw, bw_cap))
+			continue;
+
+		if (partitioning == PBW_FIRST_FIT)
+			return cpu;
+
+		/* worst fit: maximize the smaller of the two normalized
+		 * residual capacities after placing the task */
+		slack = min_t(long,
+			      UTIL_SCALE - (pedf->util + util),
+			      bw_cap ? (long) (bw_cap - (pedf->mem_budget + bw))
+					* UTIL_SCALE / bw_cap : 0);
+		if (slack > best_slack) {
+			best_slack = slack;
+			best = cpu;
+		}
+	}
+	return best;
+}
+
+static long pbw_admit_task(struct task_struct* tsk)
+{
+	unsigned long flags;
+	unsigned int util = task_util(tsk);
+	int bw = tsk_rt(tsk)->task_params.mem_budget_task;
+	int cpu;
+	pbw_domain_t *pedf;
+
+	raw_spin_lock_irqsave(&pbw_assign_lock, flags);
+
+	if (partitioning == PBW_MANUAL) {
+		cpu = tsk->rt_param.task_params.cpu;
+		if (task_cpu(tsk) != cpu
+#ifdef CONFIG_RELEASE_MASTER
+		    /* don't allow tasks on release master CPU */
+		    || cpu == remote_edf(cpu)->release_master
+#endif
+			)
+			cpu = NO_CPU;
+	} else {
+		cpu = pick_partition(util, bw);
+		if (cpu != NO_CPU)
+			tsk->rt_param.task_params.cpu = cpu;
+	}
+
+	if (cpu == NO_CPU) {
+		raw_spin_unlock_irqrestore(&pbw_assign_lock, flags);
+		printk(KERN_INFO "PBW-EDF: task %d (u=%u/%d, bw=%d MB/s) "
+		       "rejected by %s partitioning\n", tsk->pid, util,
+		       UTIL_SCALE, bw, pbw_partitioning_names[partitioning]);
+		return -EINVAL;
+	}
+
+	pedf = remote_pedf(cpu);
+	pedf->util       += util;
+	pedf->mem_budget += bw;
+	pedf->mem_wr_budget += task_wr_mem_budget(tsk);
+	pedf->num_tasks++;
+	program_partition_budget(pedf);
+
+	raw_spin_unlock_irqrestore(&pbw_assign_lock, flags);
+
+	TRACE_TASK(tsk, "assigned to P%d\n", cpu);
+	return 0;
+}
+
+static void pbw_task_exit(struct task_struct * t)
+{
+	unsigned long flags;
+	pbw_domain_t* 	pedf = task_pedf(t);
+	rt_domain_t*	edf;
+
+	raw_spin_lock_irqsave(&pedf->slock, flags);
+	if (is_queued(t)) {
+		/* dequeue */
+		edf  = task_edf(t);
+		remove(edf, t);
+	}
+	if (pedf->scheduled == t)
+		pedf->scheduled = NULL;
+
+	TRACE_TASK(t, "RIP, now reschedule\n");
+
+	preempt(pedf);
+	raw_spin_unlock_irqrestore(&pedf->slock, flags);
+
+	/* give the partition's share of the load back */
+	raw_spin_lock_irqsave(&pbw_assign_lock, flags);
+	pedf->util       -= min(pedf->util, task_util(t));
+	pedf->mem_budget -= tsk_rt(t)->task_params.mem_budget_task;
+	pedf->mem_wr_budget -= task_wr_mem_budget(t);
+	pedf->num_tasks--;
+	program_partition_budget(pedf);
+	raw_spin_unlock_irqrestore(&pbw_assign_lock, flags);
+}
+
+static struct domain_proc_info pbw_domain_proc_info;
+static long pbw_get_domain_proc_info(struct domain_proc_info **ret)
+{
+	*ret = &pbw_domain_proc_info;
+	return 0;
+}
+
+static void pbw_setup_domain_proc(void)
+{
+	int i, cpu;
+	int release_master =
+#ifdef CONFIG_RELEASE_MASTER
+		atomic_read(&release_master_cpu);
+#else
+		NO_CPU;
+#endif
+	int num_rt_cpus = num_online_cpus() - (release_master != NO_CPU);
+	struct cd_mapping *cpu_map, *domain_map;
+
+	memset(&pbw_domain_proc_info, 0, sizeof(pbw_domain_proc_info));
+	init_domain_proc_info(&pbw_domain_proc_info, num_rt_cpus, num_rt_cpus);
+	pbw_domain_proc_info.num_cpus = num_rt_cpus;
+	pbw_domain_proc_info.num_domains = num_rt_cpus;
+
+	for (cpu = 0, i = 0; cpu < num_online_cpus(); ++cpu) {
+		if (cpu == release_master)
+			continue;
+		cpu_map = &pbw_domain_proc_info.cpu_to_domains[i];
+		domain_map = &pbw_domain_proc_info.domain_to_cpus[i];
+
+		cpu_map->id = cpu;
+		domain_map->id = i; /* enumerate w/o counting the release master */
+		cpumask_set_cpu(i, cpu_map->mask);
+		cpumask_set_cpu(cpu, domain_map->mask);
+		++i;
+	}
+}
+
+static long pbw_activate_plugin(void)
+{
+	int cpu;
+	pbw_domain_t *pedf;
+
+	for_each_online_cpu(cpu) {
+		pedf = remote_pedf(cpu);
+#ifdef CONFIG_RELEASE_MASTER
+		pedf->domain.release_master = atomic_read(&release_master_cpu);
+#endif
+		pedf->util       = 0;
+		pedf->mem_budget = 0;
+		pedf->mem_wr_budget = 0;
+		pedf->num_tasks  = 0;
+	}
+
+	/* partitions draw from the single system-wide bandwidth pool; the
+	 * jobs of a partition share the limit of its core */
+	memguard_reset_pools();
+	memguard_set_shared_limit(1);
+#ifdef CONFIG_RELEASE_MASTER
+	/* MemGuard's bookkeeping joins the timer interrupts on the release
+	 * master, as under GSN-EDF */
+	memguard_set_housekeeping(atomic_read(&release_master_cpu));
+#endif
+
+	pbw_setup_domain_proc();
+
+	return 0;
+}
+
+static long pbw_deactivate_plugin(void)
+{
+	memguard_set_shared_limit(0);
+	memguard_set_housekeeping(NO_CPU);
+	destroy_domain_proc_info(&pbw_domain_proc_info);
+	return 0;
+}
+
+/*	Plugin object	*/
+static struct sched_plugin pbw_edf_plugin __cacheline_aligned_in_smp = {
+	.plugin_name		= "PBW-EDF",
+	.finish_switch		= pbw_finish_switch,
+	.task_new		= pbw_task_new,
+	.complete_job		= complete_job,
+	.task_exit		= pbw_task_exit,
+	.schedule		= pbw_schedule,
+	.task_wake_up		= pbw_task_wake_up,
+	.task_block		= pbw_task_block,
+	.admit_task		= pbw_admit_task,
+	.activate_plugin	= pbw_activate_plugin,
+	.deactivate_plugin	= pbw_deactivate_plugin,
+	.get_domain_proc_info	= pbw_get_domain_proc_info,
+};
+
+/* /proc/litmus/plugins/PBW-EDF/partitioning */
+
+static int pbw_partitioning_show(struct seq_file *m, void *v)
+{
+	seq_printf(m, "%s\n", pbw_partitioning_names[partitioning]);
+	return 0;
+}
+
+static int pbw_partitioning_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, pbw_partitioning_show, NULL);
+}
+
+static ssize_t pbw_partitioning_write(struct file *file,
+				      const char __user *buffer,
+				      size_t count, loff_t *ppos)
+{
+	char name[16];
+	int i;
+	ssize_t len;
+
+	len = copy_and_strip_from_user(buffer, count, name, sizeof(name));
+	if (len < 0)
+		return len;
+
+	for (i = 0; i < ARRAY_SIZE(pbw_partitioning_names); i++)
+		if (!strcmp(name, pbw_partitioning_names[i])) {
+			partitioning = i;
+			return count;
+		}
+
+	printk(KERN_INFO "PBW-EDF: unknown partitioning '%s'\n", name);
+	return -EINVAL;
+}
+
+static const struct file_operations pbw_partitioning_fops = {
+	.open		= pbw_partitioning_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+	.write		= pbw_partitioning_write,
+};
+
+static struct proc_dir_entry *pbw_dir = NULL, *partitioning_file = NULL;
+
+static int __init init_pbw_edf(void)
+{
+	int i, err;
+
+	/* We do not really want to support cpu hotplug, do we? ;)
+	 * However, if we are so crazy to do so,
+	 * we cannot use num_online_cpu()
+	 */
+	for (i = 0; i < num_online_cpus(); i++) {
+		pbw_domain_init(remote_pedf(i),
+				pbw_check_resched,
+				NULL, i);
+	}
+
+	err = register_sched_plugin(&pbw_edf_plugin);
+	if (!err) {
+		if (!make_plugin_proc_dir(&pbw_edf_plugin, &pbw_dir))
+			partitioning_file = proc_create("partitioning", 0644,
+						pbw_dir, &pbw_partitioning_fops);
+		else
+			printk(KERN_ERR "Could not allocate PBW-EDF procfs dir.\n");
+	}
+	return err;
+}
+
+static void clean_pbw_edf(void)
+{
+	if (partitioning_file)
+		remove_proc_entry("partitioning", pbw_dir);
+	if (pbw_dir)
+		remove_plugin_proc_dir(&pbw_edf_plugin);
+}
+
+module_init(init_pbw_edf);
+module_exit(clean_pbw_edf);
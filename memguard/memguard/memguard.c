@@ -24,29 +24,77 @@
 #  include <linux/sched/rt.h>
 #endif
 #include <linux/cpu.h>
-#include <asm/idle.h>
+#include <trace/events/sched.h>
 #include <linux/sched.h>
+#include <linux/miscdevice.h>
+#include <linux/fs.h>
+
+#include <litmus/litmus.h>
+#include <litmus/ctrlpage.h>
+#include <litmus/membw.h>
+
+#include "memguard_ioctl.h"
+
+/* last, so no later header sees CREATE_TRACE_POINTS */
+#define CREATE_TRACE_POINTS
+#include "memguard_trace.h"
 
 #define MAX_NCPUS 64
 #define CACHE_LINE_SIZE 64
 
 struct memguard_info{
-	int master;
 	ktime_t period_in_ktime;
+	ktime_t start_time;      /* epoch all per-core periods are aligned to */
 	int budget;              /* reclaimed budget */
-	long period_cnt;
+	atomic_t rt_cores;       /* cores with a linked real-time job */
+	s64 reclaim_period;      /* start (ns) of the period of the reclaimed budget */
 	spinlock_t lock;
 	int max_budget;          /* \sum(cinfo->budget) */
-	cpumask_var_t active_mask;
+	cpumask_var_t active_mask;     /* online, non-idle cores */
 	cpumask_var_t throttle_mask;
-	struct hrtimer hr_timer;
+	int housekeeping;        /* core aggregating the usage of all cores
+				    (the release master), -1: every core */
+	int shared_limit;        /* the jobs of a core share its limit:
+				    account per core, not per job */
 };
 
 struct core_info {
 	/* user configurations */
 	int budget;              /* assigned budget */
-	int limit;
-	int cur_budget;
+	int limit;               /* pending budget, applied by this core */
+	int limit_dirty;         /* limit changed since it was last applied */
+	int sched_throttled;     /* throttled by the scheduler this period */
+	int limit_mb;            /* limit in MB/s, as charged to the ledger */
+	u64 limit_bps;           /* read limit in bytes/s */
+	u64 wr_limit_bps;        /* write limit in bytes/s */
+	int pool;                /* bandwidth pool the limit is charged to */
+	int cur_budget;          /* budget in effect after donating/borrowing */
+	int burst;               /* burst of the running job in cur_budget */
+	int rt_linked;           /* a real-time job is linked to this core */
+	int donated;             /* events donated to the reclaim pool */
+	int idle;                /* the idle task runs on this core */
+	int parked;              /* period timer stopped while idle */
+	struct irq_work resume;  /* restart the periods after idling */
+	u64 used[3];             /* events used in the last three periods */
+	u64 period_val;          /* counter at the start of the period */
+	u64 ewma;                /* EWMA of the events used per period */
+	int demand_mb;           /* predicted demand above the limit (MB/s) */
+	/* usage of the last period, published for the housekeeping core */
+	u64 hk_used;
+	int hk_throttled;
+	long hk_seq;             /* period of hk_used */
+	long hk_done;            /* last period folded in by the housekeeper */
+	/* per-task accounting: old_val/wr_old_val are rebased at every switch
+	 * so that the counters show what the running job (or, for non-RT
+	 * tasks, the core) used in this period */
+	u64 acct_val,acct_wr_val;/* counters when current was switched in */
+	u64 bg_used,bg_wr_used;  /* events of non-real-time tasks this period */
+	/* write (writeback) event class, regulated like reads, no reclaim */
+	struct perf_event *wr_event;
+	int wr_budget;           /* assigned write budget */
+	int wr_limit;            /* pending write budget */
+	u64 wr_old_val;          /* write counter at the start of the period */
+	struct irq_work	wr_pending;
 	/* for control logic */
 	volatile struct task_struct * throttled_task;
 	ktime_t throttled_time;  /* absolute time when throttled */
@@ -60,43 +108,151 @@ struct core_info {
 	struct task_struct *throttle_thread;  /* forced throttle idle thread */
 	wait_queue_head_t throttle_evt; /* throttle wait queue */
 	u64 throttled_error;
+	struct hrtimer hr_timer; /* per-core period timer */
+	int period_us;           /* regulation period of this core */
+	ktime_t period_start;    /* period_us is in effect since then... */
+	long period_base;        /* ...starting after period period_base */
+	ktime_t period_time;     /* start of the current period */
+
 	/* statistics */
 	long period_cnt;         /* active periods count */
+	u64 throttle_cnt;        /* number of times this core was throttled */
+	u64 reclaimed_cnt;       /* events borrowed from the reclaim pool */
+	/* overhead of the period tick and the overflow handlers */
+	u64 tick_cnt,tick_ns,tick_max_ns;
+	u64 ovf_cnt,ovf_ns,ovf_max_ns;
 };
 
-int get_master,g_cpu;
+/* A bandwidth pool: the cores of one scheduling cluster share max_bw. */
+struct memguard_pool {
+	atomic_t remaining_bw;   /* max_bw - \sum(cinfo->limit_mb) */
+	atomic_t demand_mb;      /* \sum(cinfo->demand_mb) */
+	int max_bw;
+};
+
+int g_cpu;
 static struct memguard_info memguard_info;
+static struct memguard_pool pools[MAX_NCPUS];
 static struct core_info __percpu *core_info;
+static struct memguard_sched_ops *sched_ops;
 
 static int g_period_us=1000;
+#define MIN_PERIOD_US 100
+#define MAX_PERIOD_US 10000
 static int g_budget_pct[MAX_NCPUS];
 static int g_budget_max_bw=2100;
 //static int g_budget_max_bw=6089;
+static int g_use_reclaim=0;
+static int g_budget_min_value=1000;
+static int g_rd_event_raw=0;	/* 0: PERF_COUNT_HW_CACHE_MISSES */
+static int g_wr_event_raw=0;	/* 0: generic LLC write misses */
+static int g_use_wr=1;
+static int g_use_adaptive=0;
+static int g_ewma_shift=2;	/* EWMA weight of the last period: 1/4 */
 
 static struct dentry *memguard_dir;
 
 static void __reset_stats(void *info);
-enum hrtimer_restart period_timer_callback_master(struct hrtimer *timer);
-static void period_timer_callback_slave(void *info);
+enum hrtimer_restart period_timer_callback(struct hrtimer *timer);
+static void memguard_start_period(long new_period);
 static void memguard_process_overflow(struct irq_work *entry);
+static void memguard_process_wr_overflow(struct irq_work *entry);
 static int throttle_thread(void *arg);
 int get_membudget(int get_cpu,int get_membudget);
+int get_membudget_rw(int cpu,int rd_mb,int wr_mb);
+int get_membudget_bps(int cpu,u64 rd_bps,u64 wr_bps);
+int get_membudget_batch(const struct cpumask *cpus,
+			const struct memguard_grant *grants);
+int memguard_core_limit(int cpu);
+void memguard_set_housekeeping(int cpu);
+void memguard_set_shared_limit(int shared);
 int get_cur_budget(void);
+int memguard_pool_budget(int pool);
+int memguard_max_bw(void);
+int memguard_setup_pool(int pool,const struct cpumask *cpus);
+void memguard_reset_pools(void);
 int clean_budget(int g_cpu);
+void memguard_apply_budget(struct task_struct *prev);
+void memguard_register_sched_ops(struct memguard_sched_ops *ops);
 module_param(g_budget_max_bw, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
 MODULE_PARM_DESC(g_budget_max_bw, "maximum memory bandwidth (MB/s)");
+module_param(g_period_us, int, S_IRUSR | S_IRGRP);
+MODULE_PARM_DESC(g_period_us, "initial regulation period (us), see debugfs period");
+module_param(g_use_reclaim, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+MODULE_PARM_DESC(g_use_reclaim, "donate predicted unused budget to cores that overflow");
+module_param(g_budget_min_value, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+MODULE_PARM_DESC(g_budget_min_value, "minimum budget kept/borrowed when reclaiming (events)");
+module_param(g_rd_event_raw, int, S_IRUSR | S_IRGRP);
+MODULE_PARM_DESC(g_rd_event_raw, "raw PMU event code counted as reads (0: LLC misses)");
+module_param(g_wr_event_raw, int, S_IRUSR | S_IRGRP);
+MODULE_PARM_DESC(g_wr_event_raw, "raw PMU event code counted as writes (0: LLC write misses)");
+module_param(g_use_wr, int, S_IRUSR | S_IRGRP);
+MODULE_PARM_DESC(g_use_wr, "regulate writes with a second counter per core");
+module_param(g_use_adaptive, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+MODULE_PARM_DESC(g_use_adaptive, "share the unallocated bandwidth by predicted demand");
+module_param(g_ewma_shift, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+MODULE_PARM_DESC(g_ewma_shift, "weight of the last period in the usage EWMA is 2^-shift");
+
+/*
+ * Limits are kept in bytes per second and only turned into events for the
+ * period of a core, in one division, so small budgets and periods that do
+ * not divide a second are not rounded twice.
+ */
+static inline u64 convert_bps_to_events_period(u64 bps,int period_us)
+{
+	return div64_u64(bps*period_us,(u64)CACHE_LINE_SIZE*USEC_PER_SEC);
+}
+
+static inline u64 convert_mb_to_events_period(int mb,int period_us)
+{
+	return convert_bps_to_events_period((u64)mb<<20,period_us);
+}
 
 static inline u64 convert_mb_to_events(int mb)
 {
-	return div64_u64((u64)mb*1024*1024,
-			 CACHE_LINE_SIZE* (1000000/g_period_us));
+	return convert_mb_to_events_period(mb,g_period_us);
+}
+
+static inline int convert_events_to_mb_period(u64 events,int period_us)
+{
+	u64 divisor=(u64)period_us<<20;
+
+	return div64_u64(events*CACHE_LINE_SIZE*USEC_PER_SEC+(divisor-1),
+			 divisor);
 }
 
 static inline int convert_events_to_mb(u64 events)
 {
-	int divisor = 1024*1024;
-	int mb = div64_u64(events*CACHE_LINE_SIZE*1000 + (divisor-1), divisor);
-	return mb;
+	return convert_events_to_mb_period(events,g_period_us);
+}
+
+/* Period number of time t on a core; the first period after the epoch is 1. */
+static inline long memguard_period_of(struct core_info *cinfo,ktime_t t)
+{
+	if(ktime_before(t,cinfo->period_start))
+		return cinfo->period_base;
+	return cinfo->period_base+
+		(long)ktime_divns(ktime_sub(t,cinfo->period_start),
+				  cinfo->period_us*1000LL)+1;
+}
+
+/* End of the period of a core that time t falls into. */
+static inline ktime_t memguard_period_end(struct core_info *cinfo,ktime_t t)
+{
+	return ktime_add_ns(cinfo->period_start,
+		(memguard_period_of(cinfo,t)-cinfo->period_base)*
+		cinfo->period_us*1000LL);
+}
+
+/* account the run time of a MemGuard handler that started at t0 */
+static inline void account_overhead(u64 *cnt,u64 *sum,u64 *max,u64 t0)
+{
+	u64 d=local_clock()-t0;
+
+	(*cnt)++;
+	*sum+=d;
+	if(d>*max)
+		*max=d;
 }
 
 static inline u64 perf_event_count(struct perf_event *event){
@@ -110,58 +266,484 @@ static void print_core_info(int cpu, struct core_info *cinfo)
 }
 static inline u64 memguard_event_used(struct core_info *cinfo)
 {
-	trace_printk("perf_event_count(cinfo->event)=%llu\n",perf_event_count(cinfo->event));
 	return perf_event_count(cinfo->event) - cinfo->old_val;
 }
-static void __update_budget(void *info){
-	struct core_info *cinfo=this_cpu_ptr(core_info);
-	cinfo->limit=(unsigned long)info;
-	smp_mb();	
-	trace_printk("MSG: new budget of Core%d is %d \n",smp_processor_id(),cinfo->budget);
+
+static inline u64 memguard_wr_event_used(struct core_info *cinfo)
+{
+	return perf_event_count(cinfo->wr_event) - cinfo->wr_old_val;
 }
 
-static void __update_curbudget(void *info){
-	struct core_info *cinfo=this_cpu_ptr(core_info);
-	smp_mb();
+/*
+ * Reprogram the write counter of the local core with its current write
+ * budget, leaving left events until the next overflow.
+ */
+static void __reload_wr_event(struct core_info *cinfo,s64 left)
+{
+	struct perf_event *event=cinfo->wr_event;
 
-	cinfo->limit=(unsigned long)convert_mb_to_events(100);
-	trace_printk("clean curbudget at cpu%d \n",smp_processor_id());
+	event->pmu->stop(event,PERF_EF_UPDATE);
+	event->hw.sample_period=cinfo->wr_budget;
+	local64_set(&event->hw.period_left,left>0?left:1);
+	event->pmu->start(event,PERF_EF_RELOAD);
 }
-int get_membudget(int get_cpu,int get_membudget){
-	
-	int g_budget;
-	g_budget=(unsigned long)convert_mb_to_events(get_membudget);
-	smp_call_function_single(get_cpu,__update_budget,g_budget,0);	
-	
-	trace_printk("set cpu==%d,membudget==%d.\n",get_cpu,get_membudget);
-	return 0;
+/*
+ * Bandwidth ledger: every change of a core's limit is charged against the
+ * remaining bandwidth of its pool, so the remaining bandwidth can be read in
+ * O(1) instead of summing the limits of all online cores.
+ */
+static void ledger_set_limit(struct core_info *cinfo,int mb)
+{
+	int old=xchg(&cinfo->limit_mb,mb);
+	atomic_sub(mb-old,&pools[cinfo->pool].remaining_bw);
 }
-int get_cur_budget(void){
-//	smp_call_function_single(g_cpu,__update_curbudget,NULL,0);
-	int use,i,get_curbudget=0;
-	get_online_cpus();
+
+/* Recompute the remaining bandwidth of every pool from its member cores. */
+static void __refresh_pools(void)
+{
+	int i,used[MAX_NCPUS]={0},demand[MAX_NCPUS]={0};
+
 	for_each_online_cpu(i){
 		struct core_info *cinfo=per_cpu_ptr(core_info,i);
-//		int get_curbudget;
-		get_curbudget+=(unsigned long)convert_events_to_mb(cinfo->limit);
-		
+		used[cinfo->pool]+=cinfo->limit_mb;
+		demand[cinfo->pool]+=cinfo->demand_mb;
+	}
+	for(i=0;i<MAX_NCPUS;i++){
+		atomic_set(&pools[i].remaining_bw,pools[i].max_bw-used[i]);
+		atomic_set(&pools[i].demand_mb,demand[i]);
+	}
+}
+
+/*
+ * Adaptive budgets. Every core keeps an EWMA of the events it used per
+ * period and posts the part above its limit as demand to its pool. The
+ * bandwidth of the pool no limit is charged for is then shared out each
+ * period in proportion to the demand, on top of the limits, so the limits
+ * (the requests of real-time jobs, IDLE_BUDGET_MB elsewhere) stay guaranteed.
+ */
+static void memguard_set_demand(struct core_info *cinfo,int mb)
+{
+	int old=xchg(&cinfo->demand_mb,mb);
+	atomic_add(mb-old,&pools[cinfo->pool].demand_mb);
+}
+
+static void update_demand(struct core_info *cinfo,u64 used,int throttled)
+{
+	u64 limit=READ_ONCE(cinfo->limit);
+	int shift=clamp(g_ewma_shift,0,8);
+
+	/* the usage of a throttled core is cut off at its budget */
+	if(throttled)
+		used+=used>>1;
+	cinfo->ewma=cinfo->ewma-(cinfo->ewma>>shift)+(used>>shift);
+	if(!g_use_adaptive||cinfo->ewma<=limit)
+		memguard_set_demand(cinfo,0);
+	else
+		memguard_set_demand(cinfo,convert_events_to_mb_period(
+				cinfo->ewma-limit,cinfo->period_us));
+}
+
+/* events the local core gets on top of its limit this period */
+static int adaptive_extra(struct core_info *cinfo)
+{
+	struct memguard_pool *pool=&pools[cinfo->pool];
+	int spare=atomic_read(&pool->remaining_bw);
+	int demand=atomic_read(&pool->demand_mb);
+	int mb;
+
+	if(cinfo->demand_mb<=0||spare<=0||demand<=0)
+		return 0;
+	mb=div64_u64((u64)spare*cinfo->demand_mb,demand);
+	mb=min(mb,cinfo->demand_mb);
+	return (int)convert_mb_to_events_period(mb,cinfo->period_us);
+}
+
+/*
+ * Charge the cores in cpus to a pool of their own. The pool gets the share of
+ * g_budget_max_bw proportional to its number of cores. Meant to be called by
+ * a clustered scheduler plugin on activation, while no real-time task exists.
+ * Plugins are switched under stop_cpus(), with interrupts off everywhere and
+ * CPU hotplug excluded, so neither this nor the function below may sleep.
+ */
+int memguard_setup_pool(int pool,const struct cpumask *cpus)
+{
+	struct memguard_info *global=&memguard_info;
+	unsigned long flags;
+	int i;
+
+	if(!core_info)
+		return -ENODEV;
+	if(pool<0||pool>=MAX_NCPUS)
+		return -EINVAL;
+
+	spin_lock_irqsave(&global->lock,flags);
+	for_each_cpu_and(i,cpus,cpu_online_mask)
+		per_cpu_ptr(core_info,i)->pool=pool;
+	pools[pool].max_bw=div64_u64((u64)g_budget_max_bw*
+			cpumask_weight(cpus),num_online_cpus());
+	__refresh_pools();
+	spin_unlock_irqrestore(&global->lock,flags);
+
+	pr_info("pool%d: %d MB/s for %d cores\n",pool,pools[pool].max_bw,
+		cpumask_weight(cpus));
+	return 0;
+}
+
+/* Put every core back into the single system-wide pool 0. */
+void memguard_reset_pools(void)
+{
+	struct memguard_info *global=&memguard_info;
+	unsigned long flags;
+	int i;
+
+	if(!core_info)
+		return;
+
+	spin_lock_irqsave(&global->lock,flags);
+	for_each_online_cpu(i)
+		per_cpu_ptr(core_info,i)->pool=0;
+	for(i=0;i<MAX_NCPUS;i++)
+		pools[i].max_bw=0;
+	pools[0].max_bw=g_budget_max_bw;
+	__refresh_pools();
+	WRITE_ONCE(global->shared_limit,0);
+	spin_unlock_irqrestore(&global->lock,flags);
+	/* the plugin sets its own release master, if any */
+	memguard_set_housekeeping(-1);
+}
+
+/*
+ * Post a new limit into the pending slot of a core. The remote core is not
+ * interrupted: it picks the limit up at its next period tick, or earlier
+ * from memguard_apply_budget() when the scheduler switches tasks there.
+ */
+static void __set_pending_limit_bps(struct core_info *cinfo,u64 rd_bps,
+				    u64 wr_bps)
+{
+	WRITE_ONCE(cinfo->limit_bps,rd_bps);
+	WRITE_ONCE(cinfo->wr_limit_bps,wr_bps);
+	WRITE_ONCE(cinfo->limit,(int)convert_bps_to_events_period(rd_bps,
+					READ_ONCE(cinfo->period_us)));
+	WRITE_ONCE(cinfo->wr_limit,(int)convert_bps_to_events_period(wr_bps,
+					READ_ONCE(cinfo->period_us)));
+	smp_wmb();
+	WRITE_ONCE(cinfo->limit_dirty,1);
+}
+
+static void set_pending_limit_bps(int cpu,u64 rd_bps,u64 wr_bps)
+{
+	struct core_info *cinfo=per_cpu_ptr(core_info,cpu);
+
+	ledger_set_limit(cinfo,membw_bps_to_mb(rd_bps));
+	__set_pending_limit_bps(cinfo,rd_bps,wr_bps);
+}
+
+static void set_pending_limit(int cpu,int mb,int wr_mb)
+{
+	set_pending_limit_bps(cpu,(u64)mb<<20,(u64)wr_mb<<20);
+}
+
+/* Mark whether a real-time job is linked to a core; such cores never donate
+ * and borrow ahead of the others. */
+static void set_rt_linked(int cpu,int linked)
+{
+	struct core_info *cinfo=per_cpu_ptr(core_info,cpu);
+
+	if(xchg(&cinfo->rt_linked,linked)!=linked)
+		atomic_add(linked?1:-1,&memguard_info.rt_cores);
+}
+
+/*
+ * Budget reclaiming. At the start of a period a core that is not running a
+ * real-time job predicts its usage from the last periods and donates what it
+ * will not need to global->budget. A core whose counter overflows asks the
+ * pool for more before it gets throttled. Cores without a real-time job may
+ * not dig into a reserve of g_budget_min_value per real-time core.
+ */
+static void donate_budget(s64 cur_period,int amount)
+{
+	struct memguard_info *global=&memguard_info;
+
+	spin_lock(&global->lock);
+	if(cur_period>global->reclaim_period){
+		/* first donation of a new period: older ones expired */
+		global->reclaim_period=cur_period;
+		global->budget=0;
+	}
+	if(cur_period==global->reclaim_period)
+		global->budget+=amount;
+	spin_unlock(&global->lock);
+}
+
+static int request_budget(struct core_info *cinfo,u64 budget_used)
+{
+	struct memguard_info *global=&memguard_info;
+	int amount,avail;
+
+	if(budget_used<cinfo->budget)
+		amount=cinfo->budget-budget_used; /* take back own donation */
+	else
+		amount=g_budget_min_value;
+
+	spin_lock(&global->lock);
+	avail=global->reclaim_period==ktime_to_ns(cinfo->period_time)?
+		global->budget:0;
+	if(!cinfo->rt_linked)
+		avail-=atomic_read(&global->rt_cores)*g_budget_min_value;
+	amount=min(amount,avail);
+	if(amount>0)
+		global->budget-=amount;
+	spin_unlock(&global->lock);
+
+	return amount>0?amount:0;
+}
+
+/* Predict this period's usage and donate the rest; returns the budget kept. */
+static int predict_and_donate(struct core_info *cinfo)
+{
+	u64 predicted;
+
+	cinfo->donated=0;
+	/* only cores on the default period share a reclaim pool */
+	if(!g_use_reclaim||READ_ONCE(cinfo->rt_linked)||
+	   cinfo->period_us!=g_period_us)
+		return cinfo->budget;
+
+	predicted=div64_u64(cinfo->used[0]+cinfo->used[1]+cinfo->used[2],3);
+	predicted=max_t(u64,predicted,g_budget_min_value);
+	if(predicted>=cinfo->budget)
+		return cinfo->budget;
+
+	cinfo->donated=cinfo->budget-(int)predicted;
+	donate_budget(ktime_to_ns(cinfo->period_time),cinfo->donated);
+	trace_memguard_reclaim(smp_processor_id(),cinfo->period_cnt,
+			       cinfo->donated,(int)predicted,true);
+	return (int)predicted;
+}
+
+/* Program separate read and write limits (bytes/s) for a core. */
+int get_membudget_bps(int cpu,u64 rd_bps,u64 wr_bps){
+	TS_MEMBW_GRANT_START;
+	set_rt_linked(cpu,1);
+	set_pending_limit_bps(cpu,rd_bps,wr_bps);
+	trace_memguard_limit(cpu,membw_bps_to_mb(rd_bps),
+			     membw_bps_to_mb(wr_bps),true);
+	TS_MEMBW_GRANT_END;
+	return 0;
+}
+
+/*
+ * Program the limits of several cores at once, e.g. for the jobs linked at a
+ * synchronous release. grants is indexed by CPU. The ledger of each pool is
+ * charged once for the whole batch instead of once per core.
+ */
+int get_membudget_batch(const struct cpumask *cpus,
+			const struct memguard_grant *grants){
+	int i,delta[MAX_NCPUS]={0};
+
+	TS_MEMBW_GRANT_START;
+	for_each_cpu(i,cpus){
+		struct core_info *cinfo=per_cpu_ptr(core_info,i);
+		int mb=membw_bps_to_mb(grants[i].rd_bps);
+
+		set_rt_linked(i,1);
+		delta[cinfo->pool]+=mb-xchg(&cinfo->limit_mb,mb);
+		__set_pending_limit_bps(cinfo,grants[i].rd_bps,
+					grants[i].wr_bps);
+		trace_memguard_limit(i,mb,membw_bps_to_mb(grants[i].wr_bps),
+				     true);
 	}
-	use=g_budget_max_bw-get_curbudget;
-	trace_printk("use==%dget_curbudget==%d.\n",use,get_curbudget);
-//	pr_info("use==%dget_curbudget==%d.\n",use,get_curbudget);
-	put_online_cpus();	
-	return use;
+	for(i=0;i<MAX_NCPUS;i++)
+		if(delta[i])
+			atomic_sub(delta[i],&pools[i].remaining_bw);
+	TS_MEMBW_GRANT_END;
+	return 0;
+}
+
+/* Limit (MB/s) a core is charged for in the ledger. */
+int memguard_core_limit(int cpu){
+	return READ_ONCE(per_cpu_ptr(core_info,cpu)->limit_mb);
+}
+
+/* Program separate read and write limits (MB/s) for a core. */
+int get_membudget_rw(int cpu,int rd_mb,int wr_mb){
+	return get_membudget_bps(cpu,(u64)rd_mb<<20,(u64)wr_mb<<20);
+}
+
+int get_membudget(int get_cpu,int get_membudget){
+	return get_membudget_rw(get_cpu,get_membudget,get_membudget);
+}
+
+/* Remaining memory bandwidth (MB/s) of a pool. Lock-free. */
+int memguard_pool_budget(int pool){
+	return atomic_read(&pools[pool].remaining_bw);
+}
+
+/* Total memory bandwidth (MB/s) MemGuard may hand out. */
+int memguard_max_bw(void){
+	return g_budget_max_bw;
+}
+
+/* Remaining memory bandwidth (MB/s). Lock-free, safe under gsnedf_lock. */
+int get_cur_budget(void){
+	int budget;
+
+	TS_MEMBW_CUR_START;
+	budget=memguard_pool_budget(0);
+	TS_MEMBW_CUR_END;
+	return budget;
 }
 int clean_budget(int g_cpu)
 {
-	smp_call_function_single(g_cpu,__update_curbudget,NULL,0);
+	TS_MEMBW_CLEAN_START;
+	set_rt_linked(g_cpu,0);
+	set_pending_limit(g_cpu,IDLE_BUDGET_MB,IDLE_BUDGET_MB);
+	trace_memguard_limit(g_cpu,IDLE_BUDGET_MB,IDLE_BUDGET_MB,false);
+	TS_MEMBW_CLEAN_END;
 	return 0;
 }
+
+/*
+ * Publish the state of the local core in the control page of the real-time
+ * task running on it, so that jobs can follow their bandwidth with plain
+ * loads. Must be called on the core itself with interrupts disabled.
+ */
+static void memguard_publish(struct core_info *cinfo)
+{
+	struct control_page *cp;
+
+	if(!is_realtime(current)||!(cp=tsk_rt(current)->ctrl_page))
+		return;
+	cp->mem_limit=READ_ONCE(cinfo->limit_mb);
+	cp->mem_used=cinfo->event?memguard_event_used(cinfo):0;
+	cp->mem_period=cinfo->period_cnt;
+	cp->mem_throttle_count=cinfo->throttle_cnt;
+}
+
+/*
+ * Per-task accounting. The events a real-time job consumes are charged to
+ * the job, tagged with the start of the MemGuard period they belong to, so a
+ * job that migrates within a period takes its consumption along instead of
+ * starting with a fresh budget on every core. Non-real-time tasks share the
+ * per-core bg_used, as do all tasks while the limit is shared (see
+ * memguard_set_shared_limit()).
+ */
+static struct rt_job *memguard_job(struct core_info *cinfo,
+				   struct task_struct *t)
+{
+	s64 key=ktime_to_ns(cinfo->period_time);
+	struct rt_job *job;
+
+	if(!is_realtime(t))
+		return NULL;
+	job=&tsk_rt(t)->job_params;
+	if(job->mem_period!=key){
+		job->mem_period=key;
+		job->mem_used=job->mem_wr_used=0;
+	}
+	return job;
+}
+
+/* Charge the events since the last switch to prev and rebase the counters on
+ * what next already used. The counters must be stopped. */
+static void __memguard_switch_account(struct core_info *cinfo,
+		struct task_struct *prev,struct task_struct *next)
+{
+	u64 rd=perf_event_count(cinfo->event);
+	u64 wr=cinfo->wr_event?perf_event_count(cinfo->wr_event):0;
+	int shared=READ_ONCE(memguard_info.shared_limit);
+	struct rt_job *job;
+
+	job=shared?NULL:memguard_job(cinfo,prev);
+	if(job){
+		job->mem_used+=rd-cinfo->acct_val;
+		job->mem_wr_used+=wr-cinfo->acct_wr_val;
+	}else{
+		cinfo->bg_used+=rd-cinfo->acct_val;
+		cinfo->bg_wr_used+=wr-cinfo->acct_wr_val;
+	}
+	job=shared?NULL:memguard_job(cinfo,next);
+	cinfo->old_val=rd-(job?job->mem_used:cinfo->bg_used);
+	cinfo->wr_old_val=wr-(job?job->mem_wr_used:cinfo->bg_wr_used);
+	cinfo->acct_val=rd;
+	cinfo->acct_wr_val=wr;
+}
+
+/* A new period: everybody on the local core starts from zero. */
+static void __memguard_period_account(struct core_info *cinfo)
+{
+	cinfo->old_val=cinfo->acct_val=perf_event_count(cinfo->event);
+	if(cinfo->wr_event)
+		cinfo->wr_old_val=cinfo->acct_wr_val=
+			perf_event_count(cinfo->wr_event);
+	cinfo->bg_used=cinfo->bg_wr_used=0;
+	memguard_job(cinfo,current);
+}
+
+/*
+ * Called by the scheduler after a context switch away from prev: move the
+ * accounting to the incoming task, apply a pending limit of the local core
+ * right away instead of waiting for the next period, and publish the core
+ * state to the incoming task.
+ */
+void memguard_apply_budget(struct task_struct *prev)
+{
+	struct core_info *cinfo;
+	unsigned long flags;
+	int dirty;
+	s64 left;
+
+	if(!core_info)
+		return;
+
+	local_irq_save(flags);
+	TS_MEMBW_APPLY_START;
+	cinfo=this_cpu_ptr(core_info);
+	if(!cinfo->event)
+		goto out;
+	dirty=xchg(&cinfo->limit_dirty,0);
+	/* non-real-time tasks share bg_used, nothing to move */
+	if(!dirty&&!is_realtime(prev)&&!is_realtime(current))
+		goto out;
+
+	cinfo->event->pmu->stop(cinfo->event,PERF_EF_UPDATE);
+	if(cinfo->wr_event)
+		cinfo->wr_event->pmu->stop(cinfo->wr_event,PERF_EF_UPDATE);
+	__memguard_switch_account(cinfo,prev,current);
+	/* a burst is spent by the job that overran, nobody inherits it */
+	cinfo->cur_budget-=cinfo->burst;
+	cinfo->burst=0;
+	if(dirty){
+		cinfo->budget=READ_ONCE(cinfo->limit);
+		/* a core that became real-time takes back what it donated,
+		 * as far as nobody has borrowed it yet */
+		if(cinfo->donated&&cinfo->rt_linked){
+			spin_lock(&memguard_info.lock);
+			memguard_info.budget-=min(memguard_info.budget,
+						  cinfo->donated);
+			spin_unlock(&memguard_info.lock);
+			cinfo->donated=0;
+		}
+		cinfo->cur_budget=cinfo->budget;
+		cinfo->event->hw.sample_period=cinfo->budget;
+		if(cinfo->wr_event)
+			cinfo->wr_budget=READ_ONCE(cinfo->wr_limit);
+	}
+	left=cinfo->cur_budget-memguard_event_used(cinfo);
+	local64_set(&cinfo->event->hw.period_left,left>0?left:1);
+	cinfo->event->pmu->start(cinfo->event,PERF_EF_RELOAD);
+	if(cinfo->wr_event)
+		__reload_wr_event(cinfo,cinfo->wr_budget-
+				  memguard_wr_event_used(cinfo));
+out:
+	memguard_publish(cinfo);
+	TS_MEMBW_APPLY_END;
+	local_irq_restore(flags);
+}
 static void __start_throttle(void *info){
          struct core_info *cinfo = (struct core_info *)info;
-         ktime_t start=ktime_get();
-	
-         trace_printk("throttle at %lld\n",start.tv64);
+
+         trace_memguard_throttle(smp_processor_id(),cinfo->period_cnt,false);
 
          cinfo->throttled_task=current;
   
@@ -176,84 +758,285 @@ static void event_overflow_callback(struct perf_event *event,
 		struct perf_sample_data *data,struct pt_regs *regs){
 	struct core_info *cinfo =this_cpu_ptr(core_info);
 	BUG_ON(!cinfo);
-	trace_printk("overflow callback\n");
-	irq_work_queue(&cinfo->pending);
+	if(event==cinfo->wr_event)
+		irq_work_queue(&cinfo->wr_pending);
+	else
+		irq_work_queue(&cinfo->pending);
 }
 
-static void memguard_process_overflow(struct irq_work *entry){
-	struct core_info *cinfo=this_cpu_ptr(core_info);
+/* Is the local core regulated in the current period? */
+static int memguard_period_active(struct core_info *cinfo)
+{
 	struct memguard_info *global=&memguard_info;
-	
-	s64 budget_used;
-
-	BUG_ON(in_nmi()||!in_irq());
-	WARN_ON_ONCE(cinfo->budget > global->max_budget);
-	trace_printk("overflow at %d\n",smp_processor_id());
+	int active=1;
 
 	spin_lock(&global->lock);
 	if(!cpumask_test_cpu(smp_processor_id(),global->active_mask)){
-		spin_unlock(&global->lock);
-		trace_printk("ERR:not active\n");
-		return;
-	}else if(global->period_cnt!=cinfo->period_cnt){
-		trace_printk("ERR:global(%ld)!=local(%ld)period mismatch\n",global->period_cnt,cinfo->period_cnt);
-		spin_unlock(&global->lock);
-		return;
+		trace_memguard_error(smp_processor_id(),cinfo->period_cnt,
+				     MG_ERR_INACTIVE,0);
+		active=0;
 	}
 	spin_unlock(&global->lock);
+	if(active){
+		long now=memguard_period_of(cinfo,ktime_get());
+
+		if(now!=cinfo->period_cnt){
+			trace_memguard_error(smp_processor_id(),
+					     cinfo->period_cnt,
+					     MG_ERR_PERIOD_MISMATCH,now);
+			active=0;
+		}
+	}
+	return active;
+}
+
+/*
+ * Let a LITMUS^RT plugin handle throttling: instead of spinning in the
+ * kthrottle thread, the plugin takes the depleted job off the core and runs
+ * other work (or idles) until the next period. ops may be NULL to fall back
+ * to the kthrottle thread.
+ */
+void memguard_register_sched_ops(struct memguard_sched_ops *ops)
+{
+	/* called from activate/deactivate_plugin(): every CPU spins with
+	 * interrupts off, so no callback can still be running with the old
+	 * ops (and waiting for a grace period here would never return) */
+	WRITE_ONCE(sched_ops,ops);
+}
+
+/* Throttle the local core until the next period. */
+static void memguard_throttle(struct core_info *cinfo)
+{
+	struct memguard_info *global=&memguard_info;
+	struct memguard_sched_ops *ops=READ_ONCE(sched_ops);
+
+	cinfo->throttle_cnt++;
+	memguard_publish(cinfo);
+
+	if(ops&&ops->throttle(smp_processor_id())){
+		trace_memguard_throttle(smp_processor_id(),cinfo->period_cnt,
+					true);
+		cinfo->sched_throttled=1;
+		return;
+	}
+
+	cpumask_set_cpu(smp_processor_id(), global->throttle_mask);
+	smp_mb();
+	__start_throttle(cinfo);
+}
+
+/*
+ * A real-time job that overruns its budget first spends the burst allowance
+ * of its task (rt_task.mem_burst_bytes), once per job, before it borrows or
+ * gets throttled.
+ */
+static int memguard_burst(struct core_info *cinfo)
+{
+	struct rt_job *job=memguard_job(cinfo,current);
+	int amount;
+
+	if(!job||job->mem_burst<CACHE_LINE_SIZE)
+		return 0;
+	amount=(int)min_t(u64,div64_u64(job->mem_burst,CACHE_LINE_SIZE),
+			  convert_mb_to_events_period(g_budget_max_bw,
+						      cinfo->period_us));
+	job->mem_burst=0;
+	cinfo->burst+=amount;
+	cinfo->cur_budget+=amount;
+	local64_set(&cinfo->event->hw.period_left,amount);
+	trace_memguard_reclaim(smp_processor_id(),cinfo->period_cnt,amount,
+			       cinfo->cur_budget,false);
+	return 1;
+}
+
+static void __memguard_process_overflow(struct core_info *cinfo){
+	s64 budget_used;
+
+	BUG_ON(in_nmi()||!in_irq());
+	WARN_ON_ONCE(cinfo->budget >
+		convert_mb_to_events_period(g_budget_max_bw,cinfo->period_us));
+	/* a burst raises cur_budget above the budget of the core */
+	WARN_ON_ONCE(g_use_reclaim==0&&
+		     cinfo->cur_budget!=cinfo->budget+cinfo->burst);
+	if(!memguard_period_active(cinfo))
+		return;
 
 	budget_used = memguard_event_used(cinfo);
+	trace_memguard_overflow(smp_processor_id(),cinfo->period_cnt,
+				budget_used,cinfo->cur_budget,false);
 
-	if(budget_used < cinfo->budget){
-		trace_printk("ERR:overflow in timer . used%lld < budget%d .ignore\n",budget_used,cinfo->budget);
+	if(budget_used < cinfo->cur_budget){
+		trace_memguard_error(smp_processor_id(),cinfo->period_cnt,
+				     MG_ERR_SPURIOUS,budget_used);
 		return;
 	}
 
+	if(memguard_burst(cinfo))
+		return;
+
+	if(g_use_reclaim&&cinfo->period_us==g_period_us){
+		int amount=request_budget(cinfo,budget_used);
+		if(amount>0){
+			cinfo->cur_budget+=amount;
+			cinfo->reclaimed_cnt+=amount;
+			local64_set(&cinfo->event->hw.period_left,amount);
+			trace_memguard_reclaim(smp_processor_id(),
+					       cinfo->period_cnt,amount,
+					       cinfo->cur_budget,false);
+			return;
+		}
+	}
+
 	local64_set(&cinfo->event->hw.period_left,0xfffffff);
 	
-	if(budget_used < cinfo->budget){
-		trace_printk("ERR:throttling error\n");
+	if(budget_used < cinfo->cur_budget){
+		trace_memguard_error(smp_processor_id(),cinfo->period_cnt,
+				     MG_ERR_THROTTLE,budget_used);
 		cinfo->prev_throttle_error=1;
 	}
 	
-	if(cinfo->prev_throttle_error){
-		trace_printk("throttle_error=%d\n",cinfo->prev_throttle_error);
+	if(cinfo->prev_throttle_error)
+		return;
+
+	memguard_throttle(cinfo);
+}
+
+static void memguard_process_overflow(struct irq_work *entry){
+	struct core_info *cinfo=this_cpu_ptr(core_info);
+	u64 t0=local_clock();
+
+	__memguard_process_overflow(cinfo);
+	account_overhead(&cinfo->ovf_cnt,&cinfo->ovf_ns,&cinfo->ovf_max_ns,t0);
+}
+
+/* The write counter overflowed: writes are not reclaimed, just throttled. */
+static void __memguard_process_wr_overflow(struct core_info *cinfo){
+	s64 budget_used;
+
+	BUG_ON(in_nmi()||!in_irq());
+	if(!memguard_period_active(cinfo))
+		return;
+
+	budget_used=memguard_wr_event_used(cinfo);
+	trace_memguard_overflow(smp_processor_id(),cinfo->period_cnt,
+				budget_used,cinfo->wr_budget,true);
+	if(budget_used < cinfo->wr_budget){
+		trace_memguard_error(smp_processor_id(),cinfo->period_cnt,
+				     MG_ERR_SPURIOUS,budget_used);
 		return;
 	}
 
-	cpumask_set_cpu(smp_processor_id(), global->throttle_mask);
-	if(cpumask_test_cpu(global->master,global->throttle_mask)){
-		cpumask_clear_cpu(global->master,global->throttle_mask);
+	local64_set(&cinfo->wr_event->hw.period_left,0xfffffff);
+	memguard_throttle(cinfo);
+}
+
+static void memguard_process_wr_overflow(struct irq_work *entry){
+	struct core_info *cinfo=this_cpu_ptr(core_info);
+	u64 t0=local_clock();
+
+	__memguard_process_wr_overflow(cinfo);
+	account_overhead(&cinfo->ovf_cnt,&cinfo->ovf_ns,&cinfo->ovf_max_ns,t0);
+}
+
+static inline int memguard_is_housekeeping(int cpu)
+{
+	return READ_ONCE(memguard_info.housekeeping)==cpu;
+}
+
+/*
+ * Usage aggregation on the housekeeping core: fold the last period of every
+ * core into its EWMA and demand, so that the other cores only publish their
+ * usage at a period boundary.
+ */
+static void memguard_housekeeping(void)
+{
+	int i;
+
+	for_each_online_cpu(i){
+		struct core_info *cinfo=per_cpu_ptr(core_info,i);
+		long seq=READ_ONCE(cinfo->hk_seq);
+
+		if(!cinfo->event||seq==cinfo->hk_done)
+			continue;
+		cinfo->hk_done=seq;
+		/* a parked core dropped its demand, it gets none until it
+		 * wakes up */
+		if(READ_ONCE(cinfo->parked))
+			continue;
+		smp_rmb();
+		update_demand(cinfo,READ_ONCE(cinfo->hk_used),
+			      READ_ONCE(cinfo->hk_throttled));
+		/* the core parked meanwhile: parked is set before it drops
+		 * its demand, and both sides order that with xchg() */
+		if(READ_ONCE(cinfo->parked))
+			memguard_set_demand(cinfo,0);
 	}
-	smp_mb();
-	on_each_cpu_mask(global->throttle_mask,__start_throttle,(void *)cinfo,0);
+}
+
+/*
+ * Run the usage aggregation of all cores on cpu, normally the LITMUS^RT
+ * release master, which no real-time job runs on; -1 (NO_CPU) gives it back
+ * to every core. The housekeeping core never parks its period timer. Safe
+ * with interrupts off, as in a plugin's activate_plugin().
+ */
+void memguard_set_housekeeping(int cpu)
+{
+	struct core_info *cinfo;
 
+	if(!core_info)
+		return;
+	if(cpu>=0&&(!cpu_online(cpu)||!per_cpu_ptr(core_info,cpu)->event))
+		cpu=-1;
+	if(xchg(&memguard_info.housekeeping,cpu)==cpu||cpu<0)
+		return;
+	pr_info("cpu%d: housekeeping\n",cpu);
+
+	/* a parked core would not tick until it wakes up */
+	cinfo=per_cpu_ptr(core_info,cpu);
+	if(READ_ONCE(cinfo->parked)){
+		if(cpu==smp_processor_id())
+			irq_work_queue(&cinfo->resume);
+		else
+			irq_work_queue_on(&cinfo->resume,cpu);
+	}
+}
+
+/*
+ * Partitioned plugins program a core with the sum of the budgets of its
+ * partition, which all its jobs share: the events of a core are then charged
+ * to the core instead of to the job that runs. Cleared by
+ * memguard_reset_pools(). Safe with interrupts off.
+ */
+void memguard_set_shared_limit(int shared)
+{
+	WRITE_ONCE(memguard_info.shared_limit,shared);
 }
 
 void update_statistics(struct core_info *cinfo){
 	s64 new;
 	int used;
 	new=perf_event_count(cinfo->event);
-	used=(int)(new-cinfo->old_val);
-	trace_printk("count==%ld,old_val==%ld,used==%d\n",new,cinfo->old_val,used);
-	cinfo->old_val=new;
+	used=(int)(new-cinfo->period_val);
+	cinfo->period_val=new;
+	cinfo->used[2]=cinfo->used[1];
+	cinfo->used[1]=cinfo->used[0];
+	cinfo->used[0]=used;
 
 }
 
-static void period_timer_callback_slave(void *info){
+static void memguard_start_period(long new_period){
 	struct core_info *cinfo=this_cpu_ptr(core_info);
 	struct memguard_info *global=&memguard_info;
 
-	long new_period =(long)info;
 	int cpu=smp_processor_id();
+	long prev_period=cinfo->period_cnt;
 	
-	trace_printk("slave at %d\n",cpu);
 	BUG_ON(!irqs_disabled());
 	WARN_ON_ONCE(!in_irq());
 
 	if (new_period <= cinfo->period_cnt) {
-		trace_printk("ERR: new_period(%ld) <= cinfo->period_cnt(%ld)\n",
-			     new_period, cinfo->period_cnt);
+		trace_memguard_error(cpu,cinfo->period_cnt,
+				     MG_ERR_STALE_PERIOD,new_period);
 		return;
 	}
 	cinfo->period_cnt=new_period;
@@ -261,113 +1044,376 @@ static void period_timer_callback_slave(void *info){
 	
 	spin_lock(&global->lock);
 	cpumask_clear_cpu(cpu, global->throttle_mask);
-	cpumask_set_cpu(cpu,global->active_mask);
+	/* an idle core (the housekeeping core, or one throttled by the
+	 * scheduler) keeps ticking, but stays out until it runs a task */
+	if(!cinfo->idle)
+		cpumask_set_cpu(cpu,global->active_mask);
 	spin_unlock(&global->lock);
 
-	if(cinfo->throttled_task!=NULL){
-	trace_printk("%p|New period %ld.\n",
-		cinfo->throttled_task,cinfo->period_cnt);
-	}
 	update_statistics(cinfo);
+	if(READ_ONCE(global->housekeeping)<0){
+		update_demand(cinfo,cinfo->used[0],
+			      cinfo->throttled_task||cinfo->sched_throttled);
+	}else{
+		WRITE_ONCE(cinfo->hk_used,cinfo->used[0]);
+		WRITE_ONCE(cinfo->hk_throttled,
+			   cinfo->throttled_task||cinfo->sched_throttled);
+		smp_wmb();
+		WRITE_ONCE(cinfo->hk_seq,new_period);
+		if(memguard_is_housekeeping(cpu))
+			memguard_housekeeping();
+	}
+	if(cinfo->wr_event)
+		cinfo->wr_event->pmu->stop(cinfo->wr_event,PERF_EF_UPDATE);
+	__memguard_period_account(cinfo);
+	/* summary of the period that just ended */
+	trace_memguard_period(cpu,prev_period,cinfo->used[0],cinfo->cur_budget,
+			      cinfo->throttled_task||cinfo->sched_throttled);
 	
 	spin_lock(&global->lock);
 
+	xchg(&cinfo->limit_dirty,0);
 	if(cinfo->limit>0){
-		trace_printk("cinfo->limit==%d,cinfo->budget==%d",cinfo->limit,cinfo->budget);
 		cinfo->budget=cinfo->limit;
 	}
+	if(g_use_adaptive)
+		cinfo->budget+=adaptive_extra(cinfo);
 
-	if(cinfo->budget > global->max_budget){
-		trace_printk("ERR:c->budget(%d) > g->max_budget(%d)\n",
-				cinfo->budget,global->max_budget);
+	if(cinfo->budget > convert_mb_to_events_period(g_budget_max_bw,
+						      cinfo->period_us)){
+		trace_memguard_error(cpu,cinfo->period_cnt,MG_ERR_OVER_MAX,
+				     cinfo->budget);
 	}
 	spin_unlock(&global->lock);
 
-	if(cinfo->event->hw.sample_period != cinfo->budget){
-		trace_printk("MSG: new budget %d is assigned\n",
-				cinfo->budget);
-		cinfo->event->hw.sample_period=cinfo->budget;
-	}	
+	cinfo->cur_budget=predict_and_donate(cinfo);
+	cinfo->burst=0;
+
+	if(cinfo->event->hw.sample_period != cinfo->cur_budget)
+		cinfo->event->hw.sample_period=cinfo->cur_budget;
 
 	cinfo->throttled_task=NULL;
-	local64_set(&cinfo->event->hw.period_left,cinfo->budget);
+	local64_set(&cinfo->event->hw.period_left,cinfo->cur_budget);
 	smp_mb();
 	cinfo->event->pmu->start(cinfo->event,PERF_EF_RELOAD);
+	if(cinfo->wr_event){
+		cinfo->wr_budget=READ_ONCE(cinfo->wr_limit);
+		__reload_wr_event(cinfo,cinfo->wr_budget);
+	}
+	memguard_publish(cinfo);
+
+	if(xchg(&cinfo->sched_throttled,0)){
+		struct memguard_sched_ops *ops=READ_ONCE(sched_ops);
+		if(ops)
+			ops->unthrottle(cpu);
+	}
 }
 
 
-enum hrtimer_restart period_timer_callback_master(struct hrtimer *timer){
-	struct memguard_info *global=&memguard_info;
+/*
+ * Every core runs its own pinned timer, aligned to global->start_time, and
+ * derives the period number from the time of expiry. There is no master core
+ * and no cross-core IPI.
+ */
+enum hrtimer_restart period_timer_callback(struct hrtimer *timer){
+	struct core_info *cinfo=this_cpu_ptr(core_info);
+	ktime_t period=ns_to_ktime(cinfo->period_us*1000LL);
+	u64 t0=local_clock();
 	int orun;
-	long new_period;
 	ktime_t now;
-	cpumask_var_t active_mask;
-	zalloc_cpumask_var(&active_mask,GFP_NOWAIT);
-	
+
 	now=timer->base->get_time();
-	
-	trace_printk("master begin\n");
-	
-	BUG_ON(smp_processor_id()!=global->master);
-	orun=hrtimer_forward(timer,now,global->period_in_ktime);
-	trace_printk("orun==%d\n",orun);	
+	orun=hrtimer_forward(timer,now,period);
 	if(orun==0)
 		return HRTIMER_RESTART;
-	
-	spin_lock(&global->lock);	
-	global->period_cnt += orun;
-
-	new_period=global->period_cnt;
-	
-	smp_mb();
-	cpumask_copy(active_mask,global->active_mask);
-	smp_mb();
-	
-	spin_unlock(&global->lock);
-	
-	if (orun > 1){
-		trace_printk("ERR: timer overrun %d at period %ld\n",orun, new_period);}
+	/*
+	 * Nothing to regulate on an idle core: stop the timer until the core
+	 * wakes up. A core throttled by the scheduler idles as well but needs
+	 * the next period to get its job back.
+	 */
+	if(cinfo->idle&&!cinfo->sched_throttled&&
+	   !memguard_is_housekeeping(smp_processor_id())){
+		WRITE_ONCE(cinfo->parked,1);
+		memguard_set_demand(cinfo,0);
+		return HRTIMER_NORESTART;
+	}
+	if (orun > 1)
+		trace_memguard_error(smp_processor_id(),cinfo->period_cnt,
+				     MG_ERR_OVERRUN,orun);
 
-	on_each_cpu_mask(active_mask,period_timer_callback_slave,(void*)new_period,0);	
-	
-	smp_mb();
-	trace_printk("master end\n");
+	cinfo->period_time=ktime_sub(hrtimer_get_expires(timer),period);
+	memguard_start_period(memguard_period_of(cinfo,now));
+	account_overhead(&cinfo->tick_cnt,&cinfo->tick_ns,&cinfo->tick_max_ns,t0);
 	return HRTIMER_RESTART;
+}
+
+static void __start_period_timer(void *info)
+{
+	struct core_info *cinfo=this_cpu_ptr(core_info);
+
+	cinfo->period_start=memguard_info.start_time;
+	cinfo->period_base=0;
+	hrtimer_init(&cinfo->hr_timer,CLOCK_MONOTONIC,HRTIMER_MODE_ABS_PINNED);
+	cinfo->hr_timer.function=&period_timer_callback;
+	hrtimer_start(&cinfo->hr_timer,memguard_period_end(cinfo,ktime_get()),
+		      HRTIMER_MODE_ABS_PINNED);
+}
 
+/*
+ * The core left idle after its timer was parked: start the current period
+ * with a fresh budget (and any limit posted meanwhile) and rearm the timer.
+ */
+static void memguard_resume_period(struct irq_work *entry)
+{
+	struct core_info *cinfo=this_cpu_ptr(core_info);
+	ktime_t now=ktime_get();
+	ktime_t end=memguard_period_end(cinfo,now);
+
+	if(!cinfo->parked||
+	   (cinfo->idle&&!memguard_is_housekeeping(smp_processor_id())))
+		return;
+	cinfo->parked=0;
+	cinfo->period_time=ktime_sub_ns(end,cinfo->period_us*1000LL);
+	memguard_start_period(memguard_period_of(cinfo,now));
+	hrtimer_start(&cinfo->hr_timer,end,HRTIMER_MODE_ABS_PINNED);
+}
+
+/*
+ * Idle tracking: a core switching to its idle task leaves the active mask,
+ * and its period timer parks at the next period boundary. Runs with the
+ * runqueue locked and interrupts off, so it only flips per-core state.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 4, 0)
+static void memguard_sched_switch(void *data,bool preempt,
+		struct task_struct *prev,struct task_struct *next)
+#else
+static void memguard_sched_switch(void *data,
+		struct task_struct *prev,struct task_struct *next)
+#endif
+{
+	struct core_info *cinfo=this_cpu_ptr(core_info);
+	int cpu=smp_processor_id();
+
+	if(!cinfo->event)
+		return;
+	if(is_idle_task(next)){
+		cinfo->idle=1;
+		cpumask_clear_cpu(cpu,memguard_info.active_mask);
+	}else if(is_idle_task(prev)){
+		cinfo->idle=0;
+		cpumask_set_cpu(cpu,memguard_info.active_mask);
+		if(cinfo->parked)
+			irq_work_queue(&cinfo->resume);
+	}
+}
+
+/*
+ * Switch the local core to a new period length. The new periods start at the
+ * next multiple of the new length after the epoch, so cores whose periods
+ * divide each other stay phase-aligned. Budgets are rescaled from the limits
+ * in MB/s and take effect with the first new period.
+ */
+static void __set_period(void *info)
+{
+	struct core_info *cinfo=this_cpu_ptr(core_info);
+	int period_us=(long)info;
+	s64 period_ns=period_us*1000LL;
+	u64 since;
+
+	if(!cinfo->event||cinfo->period_us==period_us)
+		return;
+
+	hrtimer_try_to_cancel(&cinfo->hr_timer);
+	cinfo->parked=0;
+
+	since=ktime_to_ns(ktime_sub(ktime_get(),memguard_info.start_time));
+	cinfo->period_base=cinfo->period_cnt;
+	cinfo->period_start=ktime_add_ns(memguard_info.start_time,
+				(div64_u64(since,period_ns)+1)*period_ns);
+	WRITE_ONCE(cinfo->period_us,period_us);
+	WRITE_ONCE(cinfo->limit,(int)convert_bps_to_events_period(
+				cinfo->limit_bps,period_us));
+	WRITE_ONCE(cinfo->wr_limit,(int)convert_bps_to_events_period(
+				cinfo->wr_limit_bps,period_us));
+	smp_wmb();
+	WRITE_ONCE(cinfo->limit_dirty,1);
+
+	hrtimer_start(&cinfo->hr_timer,cinfo->period_start,
+		      HRTIMER_MODE_ABS_PINNED);
+	trace_memguard_set_period(smp_processor_id(),period_us,
+				  ktime_to_ns(cinfo->period_start));
+}
+
+/* "us" sets every core (and the default), "cpu us" a single core */
+static ssize_t memguard_period_write(struct file *filp,const char __user *ubuf,
+				     size_t cnt,loff_t *ppos)
+{
+	struct memguard_info *global=&memguard_info;
+	char buf[64];
+	int a,b,n,i;
+
+	if(cnt>=sizeof(buf))
+		return -EINVAL;
+	if(copy_from_user(buf,ubuf,cnt))
+		return -EFAULT;
+	buf[cnt]='\0';
+
+	n=sscanf(buf,"%d %d",&a,&b);
+	if(n==1){
+		b=a;
+		a=-1;
+	}else if(n!=2||a<0||a>=nr_cpu_ids){
+		return -EINVAL;
+	}
+	if(b<MIN_PERIOD_US||b>MAX_PERIOD_US)
+		return -EINVAL;
+
+	get_online_cpus();
+	if(a<0){
+		g_period_us=b;
+		global->period_in_ktime=ktime_set(0,g_period_us*1000);
+		global->max_budget=convert_mb_to_events(g_budget_max_bw);
+		for_each_online_cpu(i)
+			smp_call_function_single(i,__set_period,(void*)(long)b,1);
+	}else if(cpu_online(a)){
+		smp_call_function_single(a,__set_period,(void*)(long)b,1);
+	}
+	put_online_cpus();
+	return cnt;
+}
+
+static int memguard_period_show(struct seq_file *m,void *v){
+	int i;
+
+	seq_printf(m,"default: %d us\n",g_period_us);
+	for_each_online_cpu(i)
+		seq_printf(m,"CPU%d: %d us\n",i,
+			   READ_ONCE(per_cpu_ptr(core_info,i)->period_us));
+	return 0;
+}
+
+static int memguard_period_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, memguard_period_show, NULL);
+}
+
+static const struct file_operations memguard_period_fops = {
+	.open		= memguard_period_open,
+	.write          = memguard_period_write,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/* average run time of the period tick and the overflow handlers */
+static int memguard_overhead_show(struct seq_file *m,void *v){
+	int i;
+
+	seq_printf(m,"cpu |period(us)|ticks|tick avg/max(ns)|tick load(%%)|overflows|ovf avg/max(ns)\n");
+	for_each_online_cpu(i){
+		struct core_info *cinfo=per_cpu_ptr(core_info,i);
+		u64 tavg=cinfo->tick_cnt?div64_u64(cinfo->tick_ns,cinfo->tick_cnt):0;
+		u64 oavg=cinfo->ovf_cnt?div64_u64(cinfo->ovf_ns,cinfo->ovf_cnt):0;
+		/* share of the period spent in the tick, in 1/10000 */
+		u64 load=div64_u64(tavg*10000,cinfo->period_us*1000ULL);
+
+		seq_printf(m,"CPU%d: %d %llu %llu/%llu %llu.%02llu %llu %llu/%llu\n",
+			   i,cinfo->period_us,cinfo->tick_cnt,tavg,
+			   cinfo->tick_max_ns,div64_u64(load,100),load%100,
+			   cinfo->ovf_cnt,oavg,cinfo->ovf_max_ns);
+	}
+	return 0;
 }
 
+static void __reset_overhead(void *info){
+	struct core_info *cinfo=this_cpu_ptr(core_info);
 
+	cinfo->tick_cnt=cinfo->tick_ns=cinfo->tick_max_ns=0;
+	cinfo->ovf_cnt=cinfo->ovf_ns=cinfo->ovf_max_ns=0;
+}
 
+/* any write resets the statistics */
+static ssize_t memguard_overhead_write(struct file *filp,const char __user *ubuf,
+				       size_t cnt,loff_t *ppos)
+{
+	on_each_cpu(__reset_overhead,NULL,1);
+	return cnt;
+}
+
+static int memguard_overhead_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, memguard_overhead_show, NULL);
+}
+
+static const struct file_operations memguard_overhead_fops = {
+	.open		= memguard_overhead_open,
+	.write          = memguard_overhead_write,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+
+
+/*
+ * Post limits for several cores at once. Holding global->lock keeps every
+ * core from picking up its new period limit until the whole batch is posted.
+ */
+static void set_pending_limits(const struct cpumask *cpus,int mb,int wr_mb)
+{
+	struct memguard_info *global=&memguard_info;
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&global->lock,flags);
+	for_each_cpu_and(i,cpus,cpu_online_mask)
+		set_pending_limit(i,mb,wr_mb);
+	spin_unlock_irqrestore(&global->lock,flags);
+}
+
+/* "cpu mb [cpu mb ...]", pairs separated by blanks, ',' or ';' */
 static ssize_t memguard_limit_write(struct file *filp,const char __user *ubuf,size_t cnt,loff_t *ppos)
 {
+	struct memguard_info *global=&memguard_info;
 	char buf[256];
-	char *p =buf;
-	int i;
-	
-	struct memguard_info *global =&memguard_info;
+	char *p=buf,*tok;
+	int vals[2*MAX_NCPUS];
+	unsigned long flags;
+	int i,n=0;
+
+	if(cnt>=sizeof(buf))
+		return -EINVAL;
+	if(copy_from_user(buf,ubuf,cnt))
+		return -EFAULT;
+	buf[cnt]='\0';
+
+	while((tok=strsep(&p," \t\n,;"))){
+		if(!*tok)
+			continue;
+		if(n==ARRAY_SIZE(vals)||kstrtoint(tok,10,&vals[n]))
+			return -EINVAL;
+		n++;
+	}
+	if(n==0||n%2)
+		return -EINVAL;
 
-	if(copy_from_user(&buf,ubuf,(cnt>256)?256:cnt)!=0)
-		return 0;
 	get_online_cpus();
-	int cpu,input;
-	unsigned long events;
-	
-	sscanf(p,"%d",&cpu);
-	sscanf(p+2,"%d",&input);
-	pr_info("cpu%d,input%d\n",cpu,input);	
-	
-	events=(unsigned long)convert_mb_to_events(input);
-
-	pr_info("CPU%d:New budget=%ld (%d Mb/s)\n",cpu,events,input);
-	
-	smp_call_function_single(cpu,__update_budget,(void *)events,0);
-	
-	p++;
-	smp_mb();
-//	global->max_budget+=events;
-//	g_budget_max_bw=convert_events_to_mb(global->max_budget);	
+	for(i=0;i<n;i+=2){
+		if(vals[i]<0||vals[i]>=nr_cpu_ids||!cpu_online(vals[i])||
+		   vals[i+1]<=0||vals[i+1]>g_budget_max_bw){
+			put_online_cpus();
+			return -EINVAL;
+		}
+	}
+	spin_lock_irqsave(&global->lock,flags);
+	for(i=0;i<n;i+=2){
+		pr_info("CPU%d:New budget=%llu (%d Mb/s)\n",vals[i],
+			convert_mb_to_events(vals[i+1]),vals[i+1]);
+		set_pending_limit(vals[i],vals[i+1],vals[i+1]);
+	}
+	spin_unlock_irqrestore(&global->lock,flags);
 	put_online_cpus();
-	
+
 	return cnt;
 }
 
@@ -387,9 +1433,23 @@ static int memguard_limit_show(struct seq_file *m,void *v){
 			budget=cinfo->limit;
 		WARN_ON_ONCE(budget==0);
 
-		seq_printf(m,"CPU%d: %d (%dMB/s)\n",i,budget,convert_events_to_mb(budget));
+		seq_printf(m,"CPU%d: %d (%dMB/s)\n",i,budget,
+			   convert_events_to_mb_period(budget,cinfo->period_us));
+		if(g_use_reclaim)
+			seq_printf(m,"      cur %d, reclaimed %llu%s\n",
+				   cinfo->cur_budget,cinfo->reclaimed_cnt,
+				   cinfo->rt_linked?", rt":"");
+		if(g_use_adaptive)
+			seq_printf(m,"      predicted %llu, demand %dMB/s\n",
+				   cinfo->ewma,cinfo->demand_mb);
 	}
 	seq_printf(m,"g_budget_max_bw: %d MB/s,(%d)\n",g_budget_max_bw,global->max_budget);
+	for(i=0;i<MAX_NCPUS;i++){
+		if(pools[i].max_bw>0)
+			seq_printf(m,"pool%d: %d/%d MB/s remaining, %d MB/s demand\n",
+				i,atomic_read(&pools[i].remaining_bw),
+				pools[i].max_bw,atomic_read(&pools[i].demand_mb));
+	}
 	put_cpu();
 	return 0;
 }
@@ -407,21 +1467,117 @@ static const struct file_operations memguard_limit_fops = {
 	.release	= single_release,
 };
 
+static long memguard_dev_ioctl(struct file *filp,unsigned int cmd,
+			       unsigned long arg)
+{
+	struct memguard_set_limits req;
+	cpumask_var_t cpus;
+	int i;
+
+	if(cmd!=MEMGUARD_IOC_SET_LIMITS)
+		return -ENOTTY;
+	if(copy_from_user(&req,(void __user *)arg,sizeof(req)))
+		return -EFAULT;
+	if(req.rd_mb<=0||req.wr_mb<0||
+	   req.rd_mb>g_budget_max_bw||req.wr_mb>g_budget_max_bw)
+		return -EINVAL;
+	if(!req.wr_mb)
+		req.wr_mb=req.rd_mb;
+	if(!zalloc_cpumask_var(&cpus,GFP_KERNEL))
+		return -ENOMEM;
+	for(i=0;i<MEMGUARD_MAX_CPUS&&i<nr_cpu_ids;i++)
+		if(req.cpumask&(1ULL<<i))
+			cpumask_set_cpu(i,cpus);
+
+	get_online_cpus();
+	set_pending_limits(cpus,req.rd_mb,req.wr_mb);
+	put_online_cpus();
+
+	free_cpumask_var(cpus);
+	return 0;
+}
+
+/* one struct memguard_core_stat per online core */
+static ssize_t memguard_dev_read(struct file *filp,char __user *ubuf,
+				 size_t cnt,loff_t *ppos)
+{
+	struct memguard_core_stat st;
+	size_t done=0;
+	int i;
+
+	if(*ppos)
+		return 0;
+
+	get_online_cpus();
+	for_each_online_cpu(i){
+		struct core_info *cinfo=per_cpu_ptr(core_info,i);
+
+		if(done+sizeof(st)>cnt)
+			break;
+		memset(&st,0,sizeof(st));
+		st.cpu=i;
+		st.period_us=READ_ONCE(cinfo->period_us);
+		st.limit_mb=READ_ONCE(cinfo->limit_mb);
+		st.wr_limit_mb=membw_bps_to_mb(READ_ONCE(cinfo->wr_limit_bps));
+		if(cinfo->event)
+			st.used=perf_event_count(cinfo->event)-
+				READ_ONCE(cinfo->old_val);
+		if(cinfo->wr_event)
+			st.wr_used=perf_event_count(cinfo->wr_event)-
+				READ_ONCE(cinfo->wr_old_val);
+		st.period=READ_ONCE(cinfo->period_cnt);
+		st.throttle_cnt=READ_ONCE(cinfo->throttle_cnt);
+		if(copy_to_user(ubuf+done,&st,sizeof(st))){
+			put_online_cpus();
+			return -EFAULT;
+		}
+		done+=sizeof(st);
+	}
+	put_online_cpus();
+
+	*ppos+=done;
+	return done;
+}
+
+static const struct file_operations memguard_dev_fops = {
+	.owner		= THIS_MODULE,
+	.unlocked_ioctl	= memguard_dev_ioctl,
+	.read		= memguard_dev_read,
+	.llseek		= noop_llseek,
+};
+
+static struct miscdevice memguard_miscdev = {
+	.minor	= MISC_DYNAMIC_MINOR,
+	.name	= "memguard",
+	.fops	= &memguard_dev_fops,
+};
+
 static int memguard_init_debugfs(void){
 	memguard_dir=debugfs_create_dir("memguard",NULL);
 	BUG_ON(!memguard_dir);
 	debugfs_create_file("limit",0444,memguard_dir,NULL,&memguard_limit_fops);
+	debugfs_create_file("period",0644,memguard_dir,NULL,&memguard_period_fops);
+	debugfs_create_file("overhead",0644,memguard_dir,NULL,&memguard_overhead_fops);
 	return 0;
 }
 
 static void __init_per_core(void *info){
 	struct core_info *cinfo=this_cpu_ptr(core_info);
+	struct perf_event **events=(struct perf_event **)info;
+	int pool=cinfo->pool;	/* survives a CPU going offline and back */
 	memset(cinfo,0,sizeof(struct core_info));
+	cinfo->pool=pool;
 	smp_rmb();
 
-	cinfo->event=(struct perf_event *)info;
+	cinfo->event=events[0];
+	cinfo->wr_event=events[1];
+	cinfo->period_us=g_period_us;
 
 	cinfo->budget=cinfo->limit=cinfo->event->hw.sample_period;
+	cinfo->cur_budget=cinfo->budget;
+	if(cinfo->wr_event)
+		cinfo->wr_budget=cinfo->wr_limit=
+			cinfo->wr_event->hw.sample_period;
 
 	cinfo->throttled_task=NULL;
 	init_waitqueue_head(&cinfo->throttle_evt);
@@ -432,13 +1588,15 @@ static void __init_per_core(void *info){
 	
 	smp_wmb();
 	init_irq_work(&cinfo->pending,memguard_process_overflow);
+	init_irq_work(&cinfo->wr_pending,memguard_process_wr_overflow);
+	init_irq_work(&cinfo->resume,memguard_resume_period);
 }
 
-static struct perf_event *init_counter(int cpu,int budget){
+static struct perf_event *init_counter(int cpu,int budget,u32 type,u64 config){
 	struct perf_event *event=NULL;
 	struct perf_event_attr sched_perf_hw_attr={
-		.type           = PERF_TYPE_HARDWARE,
-		.config         = PERF_COUNT_HW_CACHE_MISSES,
+		.type           = type,
+		.config         = config,
 		.size		= sizeof(struct perf_event_attr),
 		.pinned		= 1,
 		.disabled	= 1,
@@ -480,6 +1638,10 @@ static void __disable_counter(void *info){
 	BUG_ON(!cinfo->event);
 	cinfo->event->pmu->stop(cinfo->event,PERF_EF_UPDATE);
 	cinfo->event->pmu->del(cinfo->event,0);
+	if(cinfo->wr_event){
+		cinfo->wr_event->pmu->stop(cinfo->wr_event,PERF_EF_UPDATE);
+		cinfo->wr_event->pmu->del(cinfo->wr_event,0);
+	}
 }
 
 static void disable_counters(void){
@@ -492,6 +1654,8 @@ static void __start_counter(void* info)
 	struct core_info *cinfo = this_cpu_ptr(core_info);
 	
 	cinfo->event->pmu->add(cinfo->event, PERF_EF_START);
+	if(cinfo->wr_event)
+		cinfo->wr_event->pmu->add(cinfo->wr_event, PERF_EF_START);
 }
 
 static void start_counters(void)
@@ -503,15 +1667,13 @@ static void start_counters(void)
 
 static void __reset_stats(void *info){
 	struct core_info *cinfo=this_cpu_ptr(core_info);
-	trace_printk("CPU%d\n",smp_processor_id());
 	cinfo->period_cnt=0;
-	cinfo->old_val=perf_event_count(cinfo->event);
+	cinfo->period_val=perf_event_count(cinfo->event);
+	__memguard_period_account(cinfo);
 	cinfo->throttled_error=0;
+	cinfo->throttle_cnt=0;
 
 	smp_mb();
-
-	trace_printk("MSG: Clear statistics of Core%d\n",
-			smp_processor_id());
 }
 
 static int throttle_thread(void *arg)
@@ -527,13 +1689,10 @@ static int throttle_thread(void *arg)
 
 	while (!kthread_should_stop() && cpu_online(cpunr)) {
 
-		trace_printk("wait an event\n");
 		wait_event_interruptible(cinfo->throttle_evt,
 					 cinfo->throttled_task ||
 					 kthread_should_stop());
 
-		trace_printk("got an event\n");
-
 		if (kthread_should_stop())
 			break;
 
@@ -546,34 +1705,120 @@ static int throttle_thread(void *arg)
 		}
 	}
 
-	trace_printk("exit\n");
 	return 0;
 }
 
 
+/* Create the counters and the kthrottle thread of a core. */
+static int memguard_init_core(int i)
+{
+	struct perf_event *events[2]={NULL,NULL};
+	struct core_info *cinfo=per_cpu_ptr(core_info,i);
+	int budget,mb;
+
+	if(g_budget_pct[i]==0)
+		g_budget_pct[i]=100/num_online_cpus();
+	mb=div64_u64((u64)g_budget_max_bw * g_budget_pct[i],100);
+	budget=convert_mb_to_events(mb);
+
+	pr_info("budget[%d]=%d(%d MB/s)\n",i,budget,mb);
+
+	/* create performance counters */
+	if(g_rd_event_raw)
+		events[0]=init_counter(i,budget,PERF_TYPE_RAW,g_rd_event_raw);
+	else
+		events[0]=init_counter(i,budget,PERF_TYPE_HARDWARE,
+				       PERF_COUNT_HW_CACHE_MISSES);
+	if(!events[0])
+		return -ENODEV;
+	if(g_use_wr&&g_wr_event_raw)
+		events[1]=init_counter(i,budget,PERF_TYPE_RAW,g_wr_event_raw);
+	else if(g_use_wr)
+		events[1]=init_counter(i,budget,PERF_TYPE_HW_CACHE,
+			PERF_COUNT_HW_CACHE_LL |
+			(PERF_COUNT_HW_CACHE_OP_WRITE << 8) |
+			(PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+	if(g_use_wr&&!events[1])
+		pr_info("cpu%d: writes are not regulated\n",i);
+	/* initialize per-core data structure */
+	smp_call_function_single(i,__init_per_core,(void*)events,1);
+	ledger_set_limit(cinfo,mb);
+	cinfo->limit_bps=cinfo->wr_limit_bps=(u64)mb<<20;
+	
+	smp_mb();
+	
+	cinfo->throttle_thread=
+		kthread_create_on_node(throttle_thread,(void*)((unsigned long)i),cpu_to_node(i),"kthrottle/%d",i);
+	BUG_ON(IS_ERR(cinfo->throttle_thread));
+	kthread_bind(cinfo->throttle_thread,i);
+	wake_up_process(cinfo->throttle_thread);
+	return 0;
+}
+
+static void __memguard_core_online(void *info)
+{
+	__start_counter(info);
+	cpumask_set_cpu(smp_processor_id(),memguard_info.active_mask);
+	__start_period_timer(info);
+}
+
+static void __memguard_core_offline(void *info)
+{
+	struct core_info *cinfo=this_cpu_ptr(core_info);
+	int cpu=smp_processor_id();
+
+	hrtimer_try_to_cancel(&cinfo->hr_timer);
+	cinfo->parked=0;
+	cinfo->throttled_task=NULL;
+	memguard_set_demand(cinfo,0);
+	__disable_counter(info);
+	cpumask_clear_cpu(cpu,memguard_info.active_mask);
+	cpumask_clear_cpu(cpu,memguard_info.throttle_mask);
+}
+
 /*
-static int memguard_idle_notifier(struct notifier_block *nb,
-		unsigned long val,void *data){
-	struct memguard_info *global=&memguard_info;
-	unsigned long flags;
+ * CPU hotplug: a core going down stops regulating, gives its bandwidth back
+ * to its pool and drops its counters; a core coming up is set up from
+ * scratch, as at module load, and joins the period grid of the others.
+ */
+static int memguard_cpu_callback(struct notifier_block *nb,
+		unsigned long action,void *hcpu)
+{
+	int cpu=(long)hcpu;
+	struct core_info *cinfo=per_cpu_ptr(core_info,cpu);
 
-	//trace_printk("idle state update:%ld\n",val);
-	spin_lock_irqsave(&global->lock,flags);
-	if(val==IDLE_START){
-		cpumask_clear_cpu(smp_processor_id(),global->active_mask);
-		//trace_printk("cpu%d is idle\n",smp_processor_id());
-	}else{
-		cpumask_set_cpu(smp_processor_id(),global->active_mask);
-		//trace_printk("cpu%d is not idle\n",smp_processor_id());
+	switch(action&~CPU_TASKS_FROZEN){
+	case CPU_ONLINE:
+	case CPU_DOWN_FAILED:
+		if(cinfo->event||memguard_init_core(cpu))
+			break;
+		smp_call_function_single(cpu,__memguard_core_online,NULL,1);
+		pr_info("cpu%d online\n",cpu);
+		break;
+	case CPU_DOWN_PREPARE:
+		if(!cinfo->event)
+			break;
+		if(memguard_is_housekeeping(cpu))
+			memguard_set_housekeeping(-1);
+		smp_call_function_single(cpu,__memguard_core_offline,NULL,1);
+		kthread_stop(cinfo->throttle_thread);
+		cinfo->throttle_thread=NULL;
+		set_rt_linked(cpu,0);
+		ledger_set_limit(cinfo,0);
+		perf_event_release_kernel(cinfo->event);
+		if(cinfo->wr_event)
+			perf_event_release_kernel(cinfo->wr_event);
+		cinfo->event=cinfo->wr_event=NULL;
+		pr_info("cpu%d offline\n",cpu);
+		break;
 	}
-	spin_unlock_irqrestore(&global->lock,flags);
-	return 0;
+	return NOTIFY_OK;
 }
 
-static struct notifier_block memguard_idle_nb={
-	.notifier_call	=memguard_idle_notifier,
+static struct notifier_block memguard_cpu_notifier={
+	.notifier_call	=memguard_cpu_callback,
 };
-*/
+
 int __init init_mem(void){
 	printk("Start memguard\n");
 	int i;
@@ -584,8 +1829,13 @@ int __init init_mem(void){
 	zalloc_cpumask_var(&global->throttle_mask,GFP_NOWAIT);
 	
 	spin_lock_init(&global->lock);
+	atomic_set(&global->rt_cores,0);
+	global->housekeeping=-1;
+	g_period_us=clamp(g_period_us,MIN_PERIOD_US,MAX_PERIOD_US);
 	global->period_in_ktime=ktime_set(0,g_period_us*1000);	
 	global->max_budget = convert_mb_to_events(g_budget_max_bw);
+	pools[0].max_bw=g_budget_max_bw;
+	atomic_set(&pools[0].remaining_bw,g_budget_max_bw);
 
 	cpumask_copy(global->active_mask,cpu_online_mask);	
 
@@ -594,38 +1844,17 @@ int __init init_mem(void){
 
 	get_online_cpus();
 	for_each_online_cpu(i){
-		struct perf_event *event;
-		struct core_info *cinfo=per_cpu_ptr(core_info,i);
-		int budget,mb;
-		if(g_budget_pct[i]==0)
-			g_budget_pct[i]=100/num_online_cpus();
-		mb=div64_u64((u64)g_budget_max_bw * g_budget_pct[i],100);
-	//	mb=100;
-		budget=convert_mb_to_events(mb);
-
-		pr_info("budget[%d]=%d(%d MB/s)\n",i,budget,mb);
-
-		/* create performance counter */
-		event=init_counter(i,budget);
-		if(event)
-			pr_info("event-----\n");
-		if(!event)
+		if(memguard_init_core(i))
 			break;
-		/* initialize per-core data structure */
-		smp_call_function_single(i,__init_per_core,(void*)event,1);
-		
-		smp_mb();
-		
-		cinfo->throttle_thread=
-			kthread_create_on_node(throttle_thread,(void*)((unsigned)i),cpu_to_node(i),"kthrottle/%d",i);
-		BUG_ON(IS_ERR(cinfo->throttle_thread));
-		kthread_bind(cinfo->throttle_thread,i);
-		wake_up_process(cinfo->throttle_thread);
-		
 	}
 	put_online_cpus();
 	smp_mb();	
 	memguard_init_debugfs();
+	if(misc_register(&memguard_miscdev)){
+		pr_err("unable to register /dev/memguard\n");
+		memguard_miscdev.minor=MISC_DYNAMIC_MINOR;
+		memguard_miscdev.this_device=NULL;
+	}
 	smp_mb();
 	pr_info("S\n");
 	start_counters();
@@ -633,37 +1862,43 @@ int __init init_mem(void){
 	
 	pr_info("Start period timer (period=%lld us)\n",div64_u64(global->period_in_ktime.tv64, 1000));
 	
-	get_cpu();
-	smp_mb();
-	global->master=smp_processor_id();
-	pr_info("master=%d\n",global->master);
-	get_master=global->master;
+	global->start_time=ktime_add(ktime_get(),global->period_in_ktime);
+	cpu_notifier_register_begin();
+	for_each_online_cpu(i){
+		if(per_cpu_ptr(core_info,i)->event)
+			smp_call_function_single(i,__start_period_timer,NULL,1);
+	}
+	__register_hotcpu_notifier(&memguard_cpu_notifier);
+	cpu_notifier_register_done();
 
-	hrtimer_init(&global->hr_timer,CLOCK_MONOTONIC,HRTIMER_MODE_REL_PINNED);
-	global->hr_timer.function=&period_timer_callback_master;
-	hrtimer_start(&global->hr_timer,global->period_in_ktime,HRTIMER_MODE_REL_PINNED);
-	smp_mb();
-	put_cpu();
-	
-//	idle_notifier_register(&memguard_idle_nb);
+	if(register_trace_sched_switch(memguard_sched_switch,NULL))
+		pr_info("no idle tracking, idle cores stay regulated\n");
 	return 0;
 }
 
 void __exit exit_mem(void){
 	int i;
-	struct memguard_info *global=&memguard_info;
 
-//	idle_notifier_unregister(&memguard_idle_nb);
+	unregister_trace_sched_switch(memguard_sched_switch,NULL);
+	tracepoint_synchronize_unregister();
+	unregister_hotcpu_notifier(&memguard_cpu_notifier);
 
 	get_online_cpus();
 	smp_mb();
 	pr_info("kill throttle threads\n");
 	on_each_cpu(__kill_throttlethread,NULL,1);
 
-	pr_info("cancel timer\n");
-	hrtimer_cancel(&global->hr_timer);
+	pr_info("cancel timers\n");
+	for_each_online_cpu(i){
+		if(per_cpu_ptr(core_info,i)->event){
+			hrtimer_cancel(&per_cpu_ptr(core_info,i)->hr_timer);
+			irq_work_sync(&per_cpu_ptr(core_info,i)->resume);
+		}
+	}
 	
 	debugfs_remove_recursive(memguard_dir);
+	if(memguard_miscdev.this_device)
+		misc_deregister(&memguard_miscdev);
 
 	disable_counters();
 
@@ -674,11 +1909,12 @@ void __exit exit_mem(void){
 		cinfo->throttled_task=NULL;
 		kthread_stop(cinfo->throttle_thread);
 		perf_event_release_kernel(cinfo->event);
+		if(cinfo->wr_event)
+			perf_event_release_kernel(cinfo->wr_event);
 	}
 
 	smp_mb();
-	
-//	unregister_hotcpu_notifier(&memguard_cpu_notifier);
+
 	free_percpu(core_info);
 
 	smp_mb();
@@ -689,8 +1925,19 @@ void __exit exit_mem(void){
 module_init(init_mem);
 module_exit(exit_mem);
 EXPORT_SYMBOL(get_membudget);
-EXPORT_SYMBOL(get_master);
+EXPORT_SYMBOL(get_membudget_rw);
+EXPORT_SYMBOL(get_membudget_bps);
+EXPORT_SYMBOL(get_membudget_batch);
+EXPORT_SYMBOL(memguard_core_limit);
+EXPORT_SYMBOL(memguard_set_housekeeping);
+EXPORT_SYMBOL(memguard_set_shared_limit);
 EXPORT_SYMBOL(clean_budget);
 EXPORT_SYMBOL(get_cur_budget);
+EXPORT_SYMBOL(memguard_apply_budget);
+EXPORT_SYMBOL(memguard_pool_budget);
+EXPORT_SYMBOL(memguard_max_bw);
+EXPORT_SYMBOL(memguard_setup_pool);
+EXPORT_SYMBOL(memguard_reset_pools);
+EXPORT_SYMBOL(memguard_register_sched_ops);
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("wsm");
@@ -0,0 +1,51 @@
+/*
+ * memguard_ioctl.h
+ *
+ * Binary interface of /dev/memguard, shared by the driver and user space.
+ *
+ *   ioctl(fd, MEMGUARD_IOC_SET_LIMITS, &req)
+ *	post read/write limits for every core in req.cpumask at once; the
+ *	limits are applied at the next period boundary of each core. Limits
+ *	above g_budget_max_bw fail with EINVAL.
+ *
+ *   read(fd, stats, n * sizeof(struct memguard_core_stat))
+ *	one record per online core, in CPU order.
+ */
+#ifndef _MEMGUARD_IOCTL_H_
+#define _MEMGUARD_IOCTL_H_
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#else
+#include <stdint.h>
+#include <sys/ioctl.h>
+typedef uint32_t __u32;
+typedef int32_t  __s32;
+typedef uint64_t __u64;
+#endif
+
+#define MEMGUARD_DEV		"/dev/memguard"
+#define MEMGUARD_MAX_CPUS	64
+
+struct memguard_set_limits {
+	__u64 cpumask;		/* bit n selects CPU n */
+	__s32 rd_mb;		/* read limit (MB/s) */
+	__s32 wr_mb;		/* write limit (MB/s), 0: same as rd_mb */
+};
+
+struct memguard_core_stat {
+	__u32 cpu;
+	__u32 period_us;	/* regulation period */
+	__s32 limit_mb;		/* read limit (MB/s) */
+	__s32 wr_limit_mb;	/* write limit (MB/s) */
+	__u64 used;		/* read events used in the current period */
+	__u64 wr_used;		/* write events used in the current period */
+	__u64 period;		/* current period number */
+	__u64 throttle_cnt;	/* times the core was throttled */
+};
+
+#define MEMGUARD_IOC_MAGIC	'M'
+#define MEMGUARD_IOC_SET_LIMITS	_IOW(MEMGUARD_IOC_MAGIC, 1, struct memguard_set_limits)
+
+#endif
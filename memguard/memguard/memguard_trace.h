@@ -0,0 +1,220 @@
+/*
+ * memguard_trace.h
+ *
+ * Tracepoints of the MemGuard driver. Enable them with
+ *   echo 1 > /sys/kernel/debug/tracing/events/memguard/enable
+ * When disabled they are patched out and cost nothing on the hot paths.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM memguard
+
+#if !defined(_MEMGUARD_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _MEMGUARD_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* memguard_error codes */
+#define MG_ERR_INACTIVE		1	/* overflow on an inactive core */
+#define MG_ERR_PERIOD_MISMATCH	2	/* overflow from a past period */
+#define MG_ERR_SPURIOUS		3	/* overflow below the budget */
+#define MG_ERR_THROTTLE		4	/* throttling error */
+#define MG_ERR_STALE_PERIOD	5	/* period tick did not advance */
+#define MG_ERR_OVER_MAX		6	/* budget above g_budget_max_bw */
+#define MG_ERR_OVERRUN		7	/* period timer overrun */
+
+/* a new regulation period started on cpu */
+TRACE_EVENT(memguard_period,
+
+	TP_PROTO(int cpu, long period, u64 used, int budget, bool throttled),
+
+	TP_ARGS(cpu, period, used, budget, throttled),
+
+	TP_STRUCT__entry(
+		__field(int,	cpu)
+		__field(long,	period)
+		__field(u64,	used)
+		__field(int,	budget)
+		__field(bool,	throttled)
+	),
+
+	TP_fast_assign(
+		__entry->cpu		= cpu;
+		__entry->period		= period;
+		__entry->used		= used;
+		__entry->budget		= budget;
+		__entry->throttled	= throttled;
+	),
+
+	TP_printk("cpu=%d period=%ld used=%llu budget=%d throttled=%d",
+		  __entry->cpu, __entry->period, __entry->used,
+		  __entry->budget, __entry->throttled)
+);
+
+/* the read or write counter of cpu ran out of budget */
+TRACE_EVENT(memguard_overflow,
+
+	TP_PROTO(int cpu, long period, u64 used, int budget, bool write),
+
+	TP_ARGS(cpu, period, used, budget, write),
+
+	TP_STRUCT__entry(
+		__field(int,	cpu)
+		__field(long,	period)
+		__field(u64,	used)
+		__field(int,	budget)
+		__field(bool,	write)
+	),
+
+	TP_fast_assign(
+		__entry->cpu	= cpu;
+		__entry->period	= period;
+		__entry->used	= used;
+		__entry->budget	= budget;
+		__entry->write	= write;
+	),
+
+	TP_printk("cpu=%d period=%ld used=%llu budget=%d write=%d",
+		  __entry->cpu, __entry->period, __entry->used,
+		  __entry->budget, __entry->write)
+);
+
+/* cpu is throttled until the end of the period */
+TRACE_EVENT(memguard_throttle,
+
+	TP_PROTO(int cpu, long period, bool sched),
+
+	TP_ARGS(cpu, period, sched),
+
+	TP_STRUCT__entry(
+		__field(int,	cpu)
+		__field(long,	period)
+		__field(bool,	sched)
+	),
+
+	TP_fast_assign(
+		__entry->cpu	= cpu;
+		__entry->period	= period;
+		__entry->sched	= sched;
+	),
+
+	TP_printk("cpu=%d period=%ld by=%s", __entry->cpu, __entry->period,
+		  __entry->sched ? "scheduler" : "kthrottle")
+);
+
+/* a new limit was posted for cpu */
+TRACE_EVENT(memguard_limit,
+
+	TP_PROTO(int cpu, int rd_mb, int wr_mb, bool rt),
+
+	TP_ARGS(cpu, rd_mb, wr_mb, rt),
+
+	TP_STRUCT__entry(
+		__field(int,	cpu)
+		__field(int,	rd_mb)
+		__field(int,	wr_mb)
+		__field(bool,	rt)
+	),
+
+	TP_fast_assign(
+		__entry->cpu	= cpu;
+		__entry->rd_mb	= rd_mb;
+		__entry->wr_mb	= wr_mb;
+		__entry->rt	= rt;
+	),
+
+	TP_printk("cpu=%d read=%dMB/s write=%dMB/s rt=%d", __entry->cpu,
+		  __entry->rd_mb, __entry->wr_mb, __entry->rt)
+);
+
+/* cpu donated budget to, or borrowed budget from, the reclaim pool */
+TRACE_EVENT(memguard_reclaim,
+
+	TP_PROTO(int cpu, long period, int amount, int budget, bool donate),
+
+	TP_ARGS(cpu, period, amount, budget, donate),
+
+	TP_STRUCT__entry(
+		__field(int,	cpu)
+		__field(long,	period)
+		__field(int,	amount)
+		__field(int,	budget)
+		__field(bool,	donate)
+	),
+
+	TP_fast_assign(
+		__entry->cpu	= cpu;
+		__entry->period	= period;
+		__entry->amount	= amount;
+		__entry->budget	= budget;
+		__entry->donate	= donate;
+	),
+
+	TP_printk("cpu=%d period=%ld %s=%d budget=%d", __entry->cpu,
+		  __entry->period, __entry->donate ? "donated" : "borrowed",
+		  __entry->amount, __entry->budget)
+);
+
+/* the regulation period of cpu changes at start_ns */
+TRACE_EVENT(memguard_set_period,
+
+	TP_PROTO(int cpu, int period_us, s64 start_ns),
+
+	TP_ARGS(cpu, period_us, start_ns),
+
+	TP_STRUCT__entry(
+		__field(int,	cpu)
+		__field(int,	period_us)
+		__field(s64,	start_ns)
+	),
+
+	TP_fast_assign(
+		__entry->cpu		= cpu;
+		__entry->period_us	= period_us;
+		__entry->start_ns	= start_ns;
+	),
+
+	TP_printk("cpu=%d period=%dus start=%lld", __entry->cpu,
+		  __entry->period_us, __entry->start_ns)
+);
+
+/* something unexpected happened; val depends on err */
+TRACE_EVENT(memguard_error,
+
+	TP_PROTO(int cpu, long period, int err, s64 val),
+
+	TP_ARGS(cpu, period, err, val),
+
+	TP_STRUCT__entry(
+		__field(int,	cpu)
+		__field(long,	period)
+		__field(int,	err)
+		__field(s64,	val)
+	),
+
+	TP_fast_assign(
+		__entry->cpu	= cpu;
+		__entry->period	= period;
+		__entry->err	= err;
+		__entry->val	= val;
+	),
+
+	TP_printk("cpu=%d period=%ld err=%s val=%lld", __entry->cpu,
+		  __entry->period,
+		  __print_symbolic(__entry->err,
+			{ MG_ERR_INACTIVE,		"inactive" },
+			{ MG_ERR_PERIOD_MISMATCH,	"period_mismatch" },
+			{ MG_ERR_SPURIOUS,		"spurious_overflow" },
+			{ MG_ERR_THROTTLE,		"throttle_error" },
+			{ MG_ERR_STALE_PERIOD,		"stale_period" },
+			{ MG_ERR_OVER_MAX,		"over_max_budget" },
+			{ MG_ERR_OVERRUN,		"timer_overrun" }),
+		  __entry->val)
+);
+
+#endif /* _MEMGUARD_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE memguard_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,18 @@
+#!/bin/bash
+# Measure the MemGuard overhead for a range of regulation periods.
+# Run while the workload of interest is active; results go to ./log/overhead.log
+
+D=/sys/kernel/debug/memguard
+PERIODS=${PERIODS:-"100 200 500 1000 2000 5000 10000"}
+SECS=${SECS:-5}
+
+mkdir -p ./log
+: > ./log/overhead.log
+for p in $PERIODS; do
+	echo $p | sudo tee $D/period > /dev/null
+	echo 0 | sudo tee $D/overhead > /dev/null
+	sleep $SECS
+	echo "== period $p us" >> ./log/overhead.log
+	sudo cat $D/overhead >> ./log/overhead.log
+done
+echo 1000 | sudo tee $D/period > /dev/null
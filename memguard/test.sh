@@ -1,15 +1,20 @@
 #!/bin/bash
+# Collect the MemGuard tracepoints into ./log, one file per event.
+#   ./test.sh start   enable the memguard events and clear the trace buffer
+#   ./test.sh         dump the trace buffer (run after the experiment)
 
-sudo cat /sys/kernel/debug/tracing/trace > ./log/l.log
-sudo cat /sys/kernel/debug/tracing/trace | grep 'overflow'> ./log/over.log
-sudo cat /sys/kernel/debug/tracing/trace | grep 'ERR'> ./log/err.log
-sudo cat /sys/kernel/debug/tracing/trace | grep 'throttle'> ./log/throttle.log
-sudo cat /sys/kernel/debug/tracing/trace | grep 'perf_event_count' > ./log/perf.log
-sudo cat /sys/kernel/debug/tracing/trace | grep 'master'> ./log/master.log
-sudo cat /sys/kernel/debug/tracing/trace | grep 'count=' > ./log/count.log
-sudo cat /sys/kernel/debug/tracing/trace | grep 'slave' > ./log/slave.log
-sudo cat /sys/kernel/debug/tracing/trace | grep 'MSG' > ./log/msg.log
-sudo cat /sys/kernel/debug/tracing/trace | grep 'limit' > ./log/limit.log
-sudo cat /sys/kernel/debug/tracing/trace | grep 'memtest' > ./log/memtest.log
-sudo dmesg > ./log/log.txt
+T=/sys/kernel/debug/tracing
+
+if [ "$1" == "start" ]; then
+	echo 1 | sudo tee $T/events/memguard/enable > /dev/null
+	echo | sudo tee $T/trace > /dev/null
+	exit 0
+fi
 
+mkdir -p ./log
+sudo cat $T/trace > ./log/l.log
+for e in period overflow throttle limit reclaim set_period error; do
+	grep "memguard_$e:" ./log/l.log > ./log/$e.log
+done
+grep 'memtest' ./log/l.log > ./log/memtest.log
+sudo dmesg > ./log/log.txt
@@ -45,6 +45,19 @@ struct control_page {
 	lt_t release;  /* Release time of current job */
 	uint64_t job_index; /* Job sequence number of current job */
 
+	/* Memory bandwidth (MB/s) requested for the next job, written by
+	 * userspace and latched by the kernel when that job is released.
+	 * 0 means use rt_task.mem_budget_task, which is also the upper
+	 * bound of any request. */
+	volatile int32_t mem_budget_req;
+
+	/* MemGuard state of the core the task runs on, written by the kernel
+	 * at every regulation period, budget overflow and context switch. */
+	volatile int32_t mem_limit;		/* core limit (MB/s) */
+	volatile uint64_t mem_used;		/* events used in this period */
+	volatile uint64_t mem_period;		/* regulation period number */
+	volatile uint64_t mem_throttle_count;	/* times the core was throttled */
+
 	/* to be extended */
 };
 
@@ -57,6 +70,11 @@ struct control_page {
 #define LITMUS_CP_OFFSET_DEADLINE	32
 #define LITMUS_CP_OFFSET_RELEASE	40
 #define LITMUS_CP_OFFSET_JOB_INDEX	48
+#define LITMUS_CP_OFFSET_MEM_BUDGET_REQ	56
+#define LITMUS_CP_OFFSET_MEM_LIMIT	60
+#define LITMUS_CP_OFFSET_MEM_USED	64
+#define LITMUS_CP_OFFSET_MEM_PERIOD	72
+#define LITMUS_CP_OFFSET_MEM_THROTTLE	80
 
 /* System call emulation via ioctl() */
 
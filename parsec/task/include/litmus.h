@@ -55,6 +55,29 @@ extern "C" {
  */
 void init_rt_task_param(struct rt_task* param);
 
+/**
+ * Set the memory bandwidth of a task in bytes per regulation period
+ * @param param Task parameters, initialised by init_rt_task_param()
+ * @param rd_bytes Bytes read per period
+ * @param wr_bytes Bytes written per period; 0: same as rd_bytes
+ * @param burst_bytes Bytes each job may read beyond its budget once; 0: none
+ * @param period_us Regulation period the budgets refer to, in microseconds
+ *
+ * Tags mem_budget_task with RT_TASK_MEM_ABI; without the tag the kernel only
+ * reads mem_budget_task (MB/s). Budgets above the MemGuard maximum are
+ * rejected by set_rt_task_param().
+ */
+static inline void set_rt_task_mem_budget(struct rt_task* param,
+	unsigned long long rd_bytes, unsigned long long wr_bytes,
+	unsigned long long burst_bytes, unsigned int period_us)
+{
+	param->mem_budget_task = RT_TASK_MEM_ABI;
+	param->mem_period_us = period_us;
+	param->mem_rd_bytes = rd_bytes;
+	param->mem_wr_bytes = wr_bytes;
+	param->mem_burst_bytes = burst_bytes;
+}
+
 /**
  * Set real-time task parameters for given process
  * @param pid PID of process
@@ -71,6 +94,21 @@ int set_rt_task_param(pid_t pid, struct rt_task* param);
  */
 int get_rt_task_param(pid_t pid, struct rt_task* param);
 
+/**
+ * Get real-time task parameters including the memory bandwidth extension
+ * @param pid PID of process
+ * @param param Real-time task parameter struct
+ * @return 0 on success
+ *
+ * On success mem_budget_task carries RT_TASK_MEM_ABI if the kernel filled in
+ * the extension; mem_budget_task & ~RT_TASK_MEM_ABI_MASK is the MB/s budget.
+ */
+static inline int get_rt_task_param_mem(pid_t pid, struct rt_task* param)
+{
+	param->mem_budget_task = RT_TASK_MEM_ABI;
+	return get_rt_task_param(pid, param);
+}
+
 /**
  * Create a new reservation/container (not supported by all plugins).
  * @param rtype The type of reservation to create.
@@ -478,6 +516,20 @@ int null_call(cycles_t *timestamp);
  */
 struct control_page* get_ctrl_page(void);
 
+/**
+ * Request memory bandwidth for the next job of the current thread
+ * @param mb Bandwidth in MB/s; 0 reverts to rt_task.mem_budget_task.
+ *           Requests above mem_budget_task are clamped by the kernel.
+ *
+ * Takes effect at the next job release, without a system call.
+ */
+static inline void request_job_mem_budget(int mb)
+{
+	struct control_page* cp = get_ctrl_page();
+	if (cp)
+		cp->mem_budget_req = mb;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -122,9 +122,26 @@ struct rt_task {
 	task_class_t	cls;
 	budget_policy_t  budget_policy;  /* ignored by pfair */
 	release_policy_t release_policy;
-	int		mem_budget_task; /*111111111111111111*/
+	int		mem_budget_task; /* read bandwidth (MB/s), 0: default */
+
+	/* Memory bandwidth extension, version 1. The kernel reads or writes
+	 * the fields below only if mem_budget_task is tagged with
+	 * RT_TASK_MEM_ABI, so the struct of binaries built before the
+	 * extension is never accessed past its end. Budgets are in bytes per
+	 * mem_period_us; the MB/s budget is then derived from them. */
+	unsigned long long mem_rd_bytes;
+	unsigned long long mem_wr_bytes;	/* 0: same as mem_rd_bytes */
+	unsigned long long mem_burst_bytes;	/* extra reads once per job */
+	unsigned int	mem_period_us;
 };
 
+/* Tag in the top bits of rt_task.mem_budget_task, which no MB/s budget
+ * reaches: bit 30 marks the extension, bits 24-29 hold its version. */
+#define RT_TASK_MEM_EXT		0x40000000
+#define RT_TASK_MEM_VERSION	1
+#define RT_TASK_MEM_ABI		(RT_TASK_MEM_EXT | (RT_TASK_MEM_VERSION << 24))
+#define RT_TASK_MEM_ABI_MASK	0x7f000000
+
 /* don't export internal data structures to user space (liblitmus) */
 #ifdef __KERNEL__
 
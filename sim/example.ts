@@ -0,0 +1,6 @@
+# NAME        WCET_US PERIOD_US DEADLINE_US BUDGET_MB RATE
+stream          3000     10000           0       600   800
+blackscholes    2000      5000           0       200   150
+fluidanimate    8000     20000           0       400   @example.trace
+dedup           4000     25000           0       300   350
+swaptions       1000      4000           0       100    60
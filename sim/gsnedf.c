@@ -0,0 +1,195 @@
+/*
+ * gsnedf.c - the GSN-EDF plugin, as in litmus-rt/sched_gsn_edf.c
+ *
+ * Jobs are linked to cores; a linked job runs right away (no scheduling
+ * latency). The lowest-priority core is found by a linear scan instead of
+ * the cpu heap of the plugin.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mgsim.h"
+
+static struct job_heap ready;		/* gsnedf.ready_queue */
+static struct job_heap depleted;	/* cpu_entry_t.depleted of all cores */
+static struct job_heap bw_wait;		/* gsnedf_bw_queue */
+
+/* edf_higher_prio: earlier deadline first, ties broken by task id */
+static int edf_higher_prio(struct job *a, struct job *b)
+{
+	if (!b)
+		return 1;
+	if (a->deadline != b->deadline)
+		return a->deadline < b->deadline;
+	return a->task->id < b->task->id;
+}
+
+void gsnedf_init(void)
+{
+	jheap_init(&ready, sim.ntasks, edf_higher_prio);
+	jheap_init(&depleted, sim.ntasks, edf_higher_prio);
+	jheap_init(&bw_wait, sim.ntasks, edf_higher_prio);
+}
+
+static void unlink(struct job *j)
+{
+	struct core *c;
+
+	if (j->linked_on == NO_CPU)
+		return;
+	c = &sim.cores[j->linked_on];
+	memguard_update(c);
+	c->linked = NULL;
+	j->linked_on = NO_CPU;
+	/* clean_budget */
+	memguard_grant(c, NULL);
+	core_reschedule(c);
+}
+
+/* link_task_to_cpu - the preempted job goes back to the ready queue */
+static void link_task_to_cpu(struct job *j, struct core *c)
+{
+	struct job *prev = c->linked;
+
+	memguard_update(c);
+	if (prev) {
+		prev->linked_on = NO_CPU;
+		jheap_insert(&ready, prev);
+	}
+	c->linked = j;
+	j->linked_on = c->id;
+	/* grant_job_membudget */
+	memguard_grant(c, j);
+	core_reschedule(c);
+}
+
+static struct core *lowest_prio_cpu(void)
+{
+	struct core *low = NULL;
+	int i;
+
+	for (i = 0; i < sim.cfg.cores; i++) {
+		struct core *c = &sim.cores[i];
+
+		if (!c->linked)
+			return c;
+		if (!low || edf_higher_prio(low->linked, c->linked))
+			low = c;
+	}
+	return low;
+}
+
+/* Bandwidth-aware linking: does the budget of j fit into what the pool has
+ * left? As in the plugin, the limit of the core j would take over is not
+ * credited. */
+static int bw_fits(struct job *j)
+{
+	return !sim.cfg.bw_aware || j->task->budget_mb <= sim.remaining_bw;
+}
+
+static void check_for_preemptions(void)
+{
+	struct job *j;
+	struct core *c;
+
+	while ((j = jheap_peek(&ready))) {
+		c = lowest_prio_cpu();
+		if (!edf_higher_prio(j, c->linked))
+			break;
+		jheap_take(&ready);
+		if (!bw_fits(j)) {
+			j->bw_blocked = 1;
+			jheap_insert(&bw_wait, j);
+			continue;
+		}
+		link_task_to_cpu(j, c);
+	}
+}
+
+/* bandwidth was given back: retry the jobs that waited for it */
+static void bw_release(void)
+{
+	struct job *j;
+
+	while ((j = jheap_take(&bw_wait))) {
+		j->bw_blocked = 0;
+		jheap_insert(&ready, j);
+	}
+}
+
+void gsnedf_release(struct task *t, lt_t when)
+{
+	struct job *j = &t->job;
+
+	j->release = when;
+	j->deadline = when + t->deadline;
+	j->remaining = t->wcet;
+	if (sim.cfg.exec_min < 1.0) {
+		double f = sim.cfg.exec_min +
+			(1.0 - sim.cfg.exec_min) * (rand_r(&sim.cfg.seed) /
+						    (double)RAND_MAX);
+		j->remaining = (lt_t)(t->wcet * f);
+		if (!j->remaining)
+			j->remaining = 1;
+	}
+	j->job_no++;
+	j->depleted = 0;
+	j->used = 0;
+	j->used_period = -1;
+	jheap_insert(&ready, j);
+	check_for_preemptions();
+}
+
+/* curr_job_completion */
+void gsnedf_job_completion(struct core *c)
+{
+	struct job *j = c->linked;
+	struct task *t = j->task;
+	lt_t resp = sim.now - j->release;
+	lt_t next = j->release + t->period;
+
+	t->jobs++;
+	t->sum_resp += resp;
+	if (resp > t->max_resp)
+		t->max_resp = resp;
+	if (sim.now > j->deadline)
+		t->misses++;
+
+	unlink(j);
+	bw_release();
+	/* a tardy job's successor is released at once, but keeps its
+	 * periodic release time (prepare_for_next_period) */
+	if (next <= sim.now)
+		gsnedf_release(t, next);
+	else
+		queue_event(next, EV_RELEASE, t->id, 0);
+	check_for_preemptions();
+}
+
+/* gsnedf_bw_throttle: take the depleted job off its core */
+int gsnedf_bw_throttle(struct core *c)
+{
+	struct job *j = c->linked;
+
+	if (!j)
+		return 0;
+	unlink(j);
+	j->depleted = 1;
+	jheap_insert(&depleted, j);
+	bw_release();
+	check_for_preemptions();
+	return 1;
+}
+
+/* gsnedf_bw_unthrottle: a new period, depleted jobs are ready again */
+void gsnedf_bw_unthrottle(void)
+{
+	struct job *j;
+
+	while ((j = jheap_take(&depleted))) {
+		j->depleted = 0;
+		jheap_insert(&ready, j);
+	}
+	bw_release();
+	check_for_preemptions();
+}
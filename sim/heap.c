@@ -0,0 +1,94 @@
+/*
+ * heap.c - binary min-heap of jobs, the bheap of the ready queue
+ */
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "mgsim.h"
+
+void jheap_init(struct job_heap *h, int cap, job_cmp_t cmp)
+{
+	h->v = calloc(cap, sizeof(*h->v));
+	if (!h->v) {
+		perror("calloc");
+		exit(1);
+	}
+	h->n = 0;
+	h->cap = cap;
+	h->cmp = cmp;
+}
+
+static void swap(struct job_heap *h, int a, int b)
+{
+	struct job *t = h->v[a];
+
+	h->v[a] = h->v[b];
+	h->v[b] = t;
+	h->v[a]->heap_idx = a;
+	h->v[b]->heap_idx = b;
+}
+
+static void sift_up(struct job_heap *h, int i)
+{
+	while (i > 0 && h->cmp(h->v[i], h->v[(i - 1) / 2])) {
+		swap(h, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void sift_down(struct job_heap *h, int i)
+{
+	for (;;) {
+		int l = 2 * i + 1, r = l + 1, m = i;
+
+		if (l < h->n && h->cmp(h->v[l], h->v[m]))
+			m = l;
+		if (r < h->n && h->cmp(h->v[r], h->v[m]))
+			m = r;
+		if (m == i)
+			return;
+		swap(h, i, m);
+		i = m;
+	}
+}
+
+void jheap_insert(struct job_heap *h, struct job *j)
+{
+	if (h->n == h->cap) {
+		fprintf(stderr, "job heap overflow\n");
+		exit(1);
+	}
+	h->v[h->n] = j;
+	j->heap_idx = h->n++;
+	sift_up(h, j->heap_idx);
+}
+
+struct job *jheap_peek(struct job_heap *h)
+{
+	return h->n ? h->v[0] : NULL;
+}
+
+void jheap_delete(struct job_heap *h, struct job *j)
+{
+	int i = j->heap_idx;
+
+	if (i < 0)
+		return;
+	h->n--;
+	if (i != h->n) {
+		h->v[i] = h->v[h->n];
+		h->v[i]->heap_idx = i;
+		sift_down(h, i);
+		sift_up(h, i);
+	}
+	j->heap_idx = -1;
+}
+
+struct job *jheap_take(struct job_heap *h)
+{
+	struct job *j = jheap_peek(h);
+
+	if (j)
+		jheap_delete(h, j);
+	return j;
+}
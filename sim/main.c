@@ -0,0 +1,352 @@
+/*
+ * main.c - task set input, event loop and report of mgsim
+ *
+ * usage: mgsim [options] TASKSET
+ *
+ * A task set has one task per line, '#' starts a comment:
+ *
+ *	NAME WCET_US PERIOD_US DEADLINE_US BUDGET_MB RATE [PHASE_US]
+ *
+ * BUDGET_MB is the bandwidth the task asks for (mem_budget_task). RATE is
+ * the bandwidth (MB/s) the task uses while running, either a number or
+ * @FILE naming a recorded trace with one MB/s value per regulation period
+ * (replayed cyclically; a relative FILE is taken from the task set's
+ * directory). A DEADLINE_US of 0 means an implicit deadline.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "mgsim.h"
+
+struct sim sim;
+
+/* event queue: binary min-heap ordered by time, then type */
+struct event {
+	lt_t		when;
+	enum event_type	type;
+	int		idx;
+	unsigned int	ver;
+};
+
+static struct event *evq;
+static int evq_n, evq_cap;
+
+static int ev_before(struct event *a, struct event *b)
+{
+	if (a->when != b->when)
+		return a->when < b->when;
+	return a->type < b->type;
+}
+
+void queue_event(lt_t when, enum event_type type, int idx, unsigned int ver)
+{
+	int i;
+
+	if (evq_n == evq_cap) {
+		evq_cap = evq_cap ? 2 * evq_cap : 1024;
+		evq = realloc(evq, evq_cap * sizeof(*evq));
+		if (!evq) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	i = evq_n++;
+	evq[i] = (struct event){ when, type, idx, ver };
+	while (i > 0 && ev_before(&evq[i], &evq[(i - 1) / 2])) {
+		struct event t = evq[i];
+
+		evq[i] = evq[(i - 1) / 2];
+		evq[(i - 1) / 2] = t;
+		i = (i - 1) / 2;
+	}
+}
+
+static struct event dequeue_event(void)
+{
+	struct event top = evq[0];
+	int i = 0;
+
+	evq[0] = evq[--evq_n];
+	for (;;) {
+		int l = 2 * i + 1, r = l + 1, m = i;
+		struct event t;
+
+		if (l < evq_n && ev_before(&evq[l], &evq[m]))
+			m = l;
+		if (r < evq_n && ev_before(&evq[r], &evq[m]))
+			m = r;
+		if (m == i)
+			break;
+		t = evq[i];
+		evq[i] = evq[m];
+		evq[m] = t;
+		i = m;
+	}
+	return top;
+}
+
+/* drop the pending event of c and queue its next one */
+void core_reschedule(struct core *c)
+{
+	lt_t next = memguard_next_event(c);
+
+	c->ver++;
+	if (next != NO_EVENT)
+		queue_event(next, EV_CORE, c->id, c->ver);
+}
+
+static double *load_trace(const char *path, int *len)
+{
+	FILE *f = fopen(path, "r");
+	double *v = NULL, x;
+	int n = 0, cap = 0;
+
+	if (!f) {
+		perror(path);
+		exit(1);
+	}
+	while (fscanf(f, "%lf", &x) == 1) {
+		if (n == cap) {
+			cap = cap ? 2 * cap : 256;
+			v = realloc(v, cap * sizeof(*v));
+			if (!v) {
+				perror("realloc");
+				exit(1);
+			}
+		}
+		v[n++] = x;
+	}
+	fclose(f);
+	if (!n) {
+		fprintf(stderr, "%s: empty trace\n", path);
+		exit(1);
+	}
+	*len = n;
+	return v;
+}
+
+static void load_taskset(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	char line[512], rate[256], file[768];
+	const char *slash = strrchr(path, '/');
+	int cap = 0;
+
+	if (!f) {
+		perror(path);
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), f)) {
+		struct task *t;
+		double wcet, period, deadline, phase = 0;
+		char *hash = strchr(line, '#');
+		int n;
+
+		if (hash)
+			*hash = '\0';
+		if (sim.ntasks == cap) {
+			cap = cap ? 2 * cap : 64;
+			sim.tasks = realloc(sim.tasks, cap * sizeof(*sim.tasks));
+			if (!sim.tasks) {
+				perror("realloc");
+				exit(1);
+			}
+		}
+		t = &sim.tasks[sim.ntasks];
+		memset(t, 0, sizeof(*t));
+		n = sscanf(line, "%31s %lf %lf %lf %d %255s %lf", t->name, &wcet,
+			   &period, &deadline, &t->budget_mb, rate, &phase);
+		if (n <= 0)
+			continue;
+		if (n < 6 || wcet <= 0 || period <= 0 || wcet > period) {
+			fprintf(stderr, "%s: bad task: %s", path, line);
+			exit(1);
+		}
+		t->id = sim.ntasks++;
+		t->wcet = (lt_t)(wcet * 1000);
+		t->period = (lt_t)(period * 1000);
+		t->deadline = deadline > 0 ? (lt_t)(deadline * 1000) : t->period;
+		t->phase = (lt_t)(phase * 1000);
+		if (rate[0] == '@' && rate[1] != '/' && slash) {
+			snprintf(file, sizeof(file), "%.*s/%s",
+				 (int)(slash - path), path, rate + 1);
+			t->trace = load_trace(file, &t->trace_len);
+		} else if (rate[0] == '@')
+			t->trace = load_trace(rate + 1, &t->trace_len);
+		else
+			t->rate_mb = atof(rate);
+		t->job.task = t;
+		t->job.linked_on = NO_CPU;
+		t->job.heap_idx = -1;
+	}
+	fclose(f);
+	if (!sim.ntasks) {
+		fprintf(stderr, "%s: no tasks\n", path);
+		exit(1);
+	}
+}
+
+static void usage(const char *prog, int status)
+{
+	fprintf(status ? stderr : stdout,
+		"usage: %s [options] TASKSET\n"
+		"  -m CORES    number of cores (1-%d, default 4)\n"
+		"  -p US       MemGuard regulation period (default 1000)\n"
+		"  -d SEC      simulated time (default 10)\n"
+		"  -M MB       g_budget_max_bw (default 2100)\n"
+		"  -t MODE     throttling: spin (kthrottle) or sched (GSN-EDF)\n"
+		"  -a          per-job accounting, budgets follow migrations\n"
+		"  -B          bandwidth-aware linking against -M\n"
+		"  -j FRAC     synthetic bandwidth jitter, +-FRAC per period\n"
+		"  -e FRAC     execution times uniform in [FRAC,1]*WCET\n"
+		"  -s SEED     random seed (default 1)\n"
+		"  -v          print per-core statistics\n"
+		"  -h          print this help\n",
+		prog, MAX_CORES);
+	exit(status);
+}
+
+static void report(double wall)
+{
+	unsigned long jobs = 0, misses = 0, throttles = 0;
+	int i;
+
+	printf("%-16s %8s %8s %10s %12s %12s\n", "task", "jobs", "misses",
+	       "throttles", "avg_resp_us", "max_resp_us");
+	for (i = 0; i < sim.ntasks; i++) {
+		struct task *t = &sim.tasks[i];
+
+		printf("%-16s %8lu %8lu %10lu %12.1f %12.1f\n", t->name,
+		       t->jobs, t->misses, t->throttles,
+		       t->jobs ? t->sum_resp / t->jobs / 1000 : 0,
+		       t->max_resp / 1000.0);
+		jobs += t->jobs;
+		misses += t->misses;
+		throttles += t->throttles;
+	}
+	if (sim.cfg.verbose) {
+		printf("\n%-6s %8s %10s %10s\n", "core", "busy%",
+		       "throttled%", "throttles");
+		for (i = 0; i < sim.cfg.cores; i++) {
+			struct core *c = &sim.cores[i];
+
+			printf("%-6d %8.2f %10.2f %10lu\n", i,
+			       100.0 * c->busy_ns / sim.now,
+			       100.0 * c->throttled_ns / sim.now,
+			       c->throttles);
+		}
+	}
+	printf("\njobs %lu, deadline misses %lu (%.3f%%), throttles %lu\n",
+	       jobs, misses, jobs ? 100.0 * misses / jobs : 0, throttles);
+	printf("%.1f s simulated in %.3f s (%lu events)\n",
+	       sim.now / 1e9, wall, sim.nevents);
+}
+
+int main(int argc, char **argv)
+{
+	struct config *cfg = &sim.cfg;
+	struct timespec t0, t1;
+	int opt, i;
+
+	cfg->cores = 4;
+	cfg->period = 1000 * 1000;
+	cfg->duration = 10ULL * 1000000000;
+	cfg->max_bw = 2100;
+	cfg->throttle = THROTTLE_SPIN;
+	cfg->exec_min = 1.0;
+	cfg->seed = 1;
+
+	while ((opt = getopt(argc, argv, "m:p:d:M:t:aBj:e:s:vh")) != -1) {
+		switch (opt) {
+		case 'm':
+			cfg->cores = atoi(optarg);
+			break;
+		case 'p':
+			cfg->period = (lt_t)(atof(optarg) * 1000);
+			break;
+		case 'd':
+			cfg->duration = (lt_t)(atof(optarg) * 1e9);
+			break;
+		case 'M':
+			cfg->max_bw = atoi(optarg);
+			break;
+		case 't':
+			if (!strcmp(optarg, "spin"))
+				cfg->throttle = THROTTLE_SPIN;
+			else if (!strcmp(optarg, "sched"))
+				cfg->throttle = THROTTLE_SCHED;
+			else
+				usage(argv[0], 1);
+			break;
+		case 'a':
+			cfg->per_job = 1;
+			break;
+		case 'B':
+			cfg->bw_aware = 1;
+			break;
+		case 'j':
+			cfg->jitter = atof(optarg);
+			break;
+		case 'e':
+			cfg->exec_min = atof(optarg);
+			break;
+		case 's':
+			cfg->seed = atoi(optarg);
+			break;
+		case 'v':
+			cfg->verbose = 1;
+			break;
+		case 'h':
+			usage(argv[0], 0);
+		default:
+			usage(argv[0], 1);
+		}
+	}
+	if (optind != argc - 1 || cfg->cores < 1 || cfg->cores > MAX_CORES ||
+	    !cfg->period || cfg->exec_min <= 0 || cfg->exec_min > 1)
+		usage(argv[0], 1);
+
+	load_taskset(argv[optind]);
+	sim.remaining_bw = cfg->max_bw;
+	for (i = 0; i < cfg->cores; i++) {
+		sim.cores[i].id = i;
+		memguard_grant(&sim.cores[i], NULL);
+	}
+	gsnedf_init();
+	for (i = 0; i < sim.ntasks; i++)
+		queue_event(sim.tasks[i].phase, EV_RELEASE, i, 0);
+	queue_event(cfg->period, EV_PERIOD, 0, 0);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	while (evq_n) {
+		struct event ev = dequeue_event();
+
+		if (ev.when > cfg->duration)
+			break;
+		sim.now = ev.when;
+		sim.nevents++;
+		switch (ev.type) {
+		case EV_PERIOD:
+			memguard_period();
+			queue_event(sim.now + cfg->period, EV_PERIOD, 0, 0);
+			break;
+		case EV_RELEASE:
+			gsnedf_release(&sim.tasks[ev.idx], sim.now);
+			break;
+		case EV_CORE:
+			if (ev.ver == sim.cores[ev.idx].ver)
+				memguard_core_event(&sim.cores[ev.idx]);
+			break;
+		}
+	}
+	sim.now = cfg->duration;
+	for (i = 0; i < cfg->cores; i++)
+		memguard_update(&sim.cores[i]);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	report((t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+	return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * memguard.c - the MemGuard regulator, as in memguard/memguard/memguard.c
+ *
+ * Every core has a budget of events (LLC misses) per regulation period,
+ * programmed from the bandwidth of the job linked to it. When a core runs
+ * out of budget it is throttled until the next period, either by spinning
+ * (kthrottle) or by the scheduler (memguard_sched_ops). All periods are
+ * aligned. Event counts are continuous; the counter overflows exactly when
+ * the budget is used up.
+ */
+#include <math.h>
+
+#include "mgsim.h"
+
+/* convert_mb_to_events_period */
+double mb_to_events(double mb, lt_t period)
+{
+	return mb * 1024 * 1024 / CACHE_LINE_SIZE * (period / 1e9);
+}
+
+/* cheap deterministic noise in [-1,1] for task t in period p */
+static double noise(int t, long p)
+{
+	uint64_t x = (uint64_t)sim.cfg.seed * 0x9e3779b97f4a7c15ULL ^
+		((uint64_t)t << 32) ^ (uint64_t)p;
+
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return (x >> 11) * (2.0 / 9007199254740992.0) - 1.0;
+}
+
+/* events per ns the job of t issues in the current period */
+static double rate_of(struct task *t)
+{
+	double mb = t->trace ? t->trace[sim.period_no % t->trace_len] :
+		t->rate_mb;
+
+	if (sim.cfg.jitter > 0)
+		mb *= 1.0 + sim.cfg.jitter * noise(t->id, sim.period_no);
+	if (mb < 0)
+		mb = 0;
+	return mb * 1024 * 1024 / CACHE_LINE_SIZE / 1e9;
+}
+
+/* events charged against the budget of c: the core's or, with per-job
+ * accounting, those its job used in this period on any core */
+static double *used_of(struct core *c)
+{
+	struct job *j = c->linked;
+
+	if (!sim.cfg.per_job || !j)
+		return &c->used;
+	if (j->used_period != sim.period_no) {
+		j->used_period = sim.period_no;
+		j->used = 0;
+	}
+	return &j->used;
+}
+
+/* get_membudget / clean_budget, applied right away as by
+ * memguard_apply_budget() at the next context switch. The pool is charged
+ * the limit of every core, IDLE_BUDGET_MB for a core without a job
+ * (ledger_set_limit). */
+void memguard_grant(struct core *c, struct job *j)
+{
+	int mb = j ? j->task->budget_mb : IDLE_BUDGET_MB;
+
+	sim.remaining_bw -= mb - c->limit_mb;
+	c->limit_mb = mb;
+	c->budget = mb_to_events(mb, sim.cfg.period);
+}
+
+/* account the progress of c up to now */
+void memguard_update(struct core *c)
+{
+	lt_t dt = sim.now - c->last;
+	struct job *j = c->linked;
+	double ev;
+
+	c->last = sim.now;
+	if (!j || !dt)
+		return;
+	if (c->throttled) {
+		c->throttled_ns += dt;
+		return;
+	}
+	if (dt > j->remaining)
+		dt = j->remaining;
+	c->busy_ns += dt;
+	j->remaining -= dt;
+	ev = rate_of(j->task) * dt;
+	c->used += ev;
+	if (sim.cfg.per_job)
+		*used_of(c) += ev;
+}
+
+/* next completion or counter overflow on c, NO_EVENT if none */
+lt_t memguard_next_event(struct core *c)
+{
+	struct job *j = c->linked;
+	lt_t next;
+	double r, left;
+
+	if (!j || c->throttled)
+		return NO_EVENT;
+	next = sim.now + j->remaining;
+	r = rate_of(j->task);
+	if (r > 0) {
+		left = c->budget - *used_of(c);
+		if (left <= r)
+			return sim.now;
+		if (sim.now + (lt_t)ceil(left / r) < next)
+			next = sim.now + (lt_t)ceil(left / r);
+	}
+	return next;
+}
+
+static void memguard_throttle(struct core *c)
+{
+	c->throttles++;
+	c->linked->task->throttles++;
+	if (sim.cfg.throttle == THROTTLE_SCHED && gsnedf_bw_throttle(c))
+		return;
+	c->throttled = 1;
+	core_reschedule(c);
+}
+
+void memguard_core_event(struct core *c)
+{
+	struct job *j = c->linked;
+
+	memguard_update(c);
+	if (!j || c->throttled)
+		return;
+	if (!j->remaining)
+		gsnedf_job_completion(c);
+	else if (c->budget - *used_of(c) <= rate_of(j->task))
+		memguard_throttle(c);
+	else
+		core_reschedule(c);
+}
+
+/* memguard_start_period on every core */
+void memguard_period(void)
+{
+	int i;
+
+	for (i = 0; i < sim.cfg.cores; i++)
+		memguard_update(&sim.cores[i]);
+	sim.period_no++;
+	for (i = 0; i < sim.cfg.cores; i++) {
+		sim.cores[i].used = 0;
+		sim.cores[i].throttled = 0;
+	}
+	if (sim.cfg.throttle == THROTTLE_SCHED)
+		gsnedf_bw_unthrottle();
+	/* the bandwidth of the jobs may change with the period */
+	for (i = 0; i < sim.cfg.cores; i++)
+		core_reschedule(&sim.cores[i]);
+}
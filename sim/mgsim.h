@@ -0,0 +1,137 @@
+/*
+ * mgsim - user-space simulator of GSN-EDF scheduling under MemGuard
+ * memory bandwidth regulation.
+ *
+ * The scheduler follows litmus-rt/sched_gsn_edf.c (link_task_to_cpu,
+ * check_for_preemptions, curr_job_completion), the regulator follows
+ * memguard/memguard/memguard.c (aligned periods, overflow, throttling).
+ * Scheduling and regulation overheads are not modelled.
+ */
+#ifndef _MGSIM_H_
+#define _MGSIM_H_
+
+#include <stdint.h>
+
+typedef unsigned long long lt_t;	/* time in ns, as in LITMUS^RT */
+
+#define NO_CPU		(-1)
+#define NO_EVENT	((lt_t)-1)
+#define MAX_CORES	128
+#define CACHE_LINE_SIZE	64
+#define IDLE_BUDGET_MB	100	/* limit of a core without a linked job */
+
+/* how a core that exhausted its budget is throttled */
+enum throttle_mode {
+	THROTTLE_SPIN,	/* kthrottle spins on the core until the next period */
+	THROTTLE_SCHED,	/* GSN-EDF takes the depleted job off the core */
+};
+
+struct task;
+
+struct job {
+	struct task	*task;
+	lt_t		release;
+	lt_t		deadline;
+	lt_t		remaining;	/* execution time left */
+	unsigned int	job_no;
+	int		linked_on;	/* core or NO_CPU */
+	int		heap_idx;	/* position in a heap, -1 if none */
+	int		depleted;	/* taken off by THROTTLE_SCHED */
+	int		bw_blocked;	/* waiting for bandwidth (-B) */
+	double		used;		/* events of this job in used_period */
+	long		used_period;
+};
+
+struct task {
+	int		id;
+	char		name[32];
+	lt_t		wcet, period, deadline, phase;
+	int		budget_mb;	/* requested bandwidth (mem_budget_task) */
+	double		rate_mb;	/* bandwidth used while running */
+	double		*trace;		/* recorded MB/s per MemGuard period */
+	int		trace_len;
+	struct job	job;		/* at most one pending job */
+
+	/* statistics */
+	unsigned long	jobs, misses, throttles;
+	lt_t		max_resp;
+	double		sum_resp;
+};
+
+struct core {
+	int		id;
+	struct job	*linked;
+	double		budget;		/* events per period */
+	int		limit_mb;	/* charged to the pool (ledger) */
+	double		used;		/* events used in the current period */
+	int		throttled;	/* THROTTLE_SPIN until the period ends */
+	lt_t		last;		/* progress accounted up to here */
+	unsigned int	ver;		/* invalidates queued core events */
+
+	/* statistics */
+	lt_t		busy_ns, throttled_ns;
+	unsigned long	throttles;
+};
+
+struct config {
+	int		cores;
+	lt_t		period;		/* MemGuard regulation period */
+	lt_t		duration;
+	int		max_bw;		/* g_budget_max_bw */
+	enum throttle_mode throttle;
+	int		per_job;	/* budgets follow migrating jobs */
+	int		bw_aware;	/* link only if the pool has bandwidth */
+	double		jitter;		/* synthetic +-fraction per period */
+	double		exec_min;	/* execution time in [exec_min,1]*wcet */
+	unsigned int	seed;
+	int		verbose;
+};
+
+/* simulation state, shared by the scheduler and the regulator */
+struct sim {
+	struct config	cfg;
+	lt_t		now;
+	long		period_no;
+	struct core	cores[MAX_CORES];
+	struct task	*tasks;
+	int		ntasks;
+	int		remaining_bw;	/* max_bw - \sum core limits */
+	unsigned long	nevents;
+};
+
+extern struct sim sim;
+
+/* heap.c: binary min-heap of jobs */
+typedef int (*job_cmp_t)(struct job *a, struct job *b);
+struct job_heap {
+	struct job	**v;
+	int		n, cap;
+	job_cmp_t	cmp;
+};
+void jheap_init(struct job_heap *h, int cap, job_cmp_t cmp);
+void jheap_insert(struct job_heap *h, struct job *j);
+struct job *jheap_peek(struct job_heap *h);
+struct job *jheap_take(struct job_heap *h);
+void jheap_delete(struct job_heap *h, struct job *j);
+
+/* event queue, in main.c */
+enum event_type { EV_PERIOD, EV_RELEASE, EV_CORE };
+void queue_event(lt_t when, enum event_type type, int idx, unsigned int ver);
+void core_reschedule(struct core *c);
+
+/* gsnedf.c */
+void gsnedf_init(void);
+void gsnedf_release(struct task *t, lt_t when);
+void gsnedf_job_completion(struct core *c);
+int gsnedf_bw_throttle(struct core *c);
+void gsnedf_bw_unthrottle(void);
+
+/* memguard.c */
+double mb_to_events(double mb, lt_t period);
+void memguard_grant(struct core *c, struct job *j);
+void memguard_update(struct core *c);
+lt_t memguard_next_event(struct core *c);
+void memguard_core_event(struct core *c);
+void memguard_period(void);
+
+#endif